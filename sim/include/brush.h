@@ -0,0 +1,27 @@
+#ifndef BRUSH_H_
+#define BRUSH_H_
+#include <stdlib.h>
+
+// Cells [start, start + len) of row `row`, relative to the stamp corner
+typedef struct {
+	int row, start, len;
+} BrushSpan;
+
+#define MAX_BRUSH_SIZE 1024  // in cells
+
+// Round brush of `size` cells across as row spans
+typedef struct {
+	size_t size;
+	BrushSpan *spans;
+	size_t len;
+} BrushStamp;
+
+// Stamps built so far, indexed by size. Not shared between threads.
+typedef struct {
+	BrushStamp *stamps;
+	size_t cap;
+} BrushStampCache;
+const BrushStamp *GetBrushStamp(BrushStampCache *cache, size_t size);
+void FreeBrushStampCache(BrushStampCache *cache);
+
+#endif
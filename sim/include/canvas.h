@@ -0,0 +1,232 @@
+#ifndef CANVAS_H_
+#define CANVAS_H_ 1
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "raylib.h"
+#include "thread_pool.h"
+
+// Particle storage and the simulation kernel. Only raylib's types are used
+// here so the kernel can be built without a window, see bench.c.
+
+// clang-format off
+// Canvas storage layout
+#define CANVAS_PADDING   1    // ghost border cells around each side
+#define CANVAS_ALIGNMENT 64   // byte alignment of every canvas row
+#define CHUNK_SIZE       32   // chunk edge length in cells
+#define MAX_CANVAS_SIZE  16384 // visible cells on either axis
+
+#define BORDER_COLOR (Color){255, 255, 255, 255}     // White
+#define AIR_COLOR    (Color){0, 0, 0, 0}             // Transparent
+#define SAND_COLOR   (Color){255, 255, 51, 255}      // Yellow
+#define WATER_COLOR  (Color){0, 121, 241, 255}       // Blue
+#define STONE_COLOR  (Color){128, 128, 128, 255}     // Grey
+#define WOOD_COLOR   (Color){139, 69, 19, 255}       // Brown
+
+// Particle properties
+#define PARTICLE_INVISIBLE            (1 << 0)
+#define PARTICLE_AFFECTED_BY_GRAVITY  (1 << 1)
+#define PARTICLE_FLAMMABLE            (1 << 2)
+#define PARTICLE_EXPLOSIVE            (1 << 3)
+
+// Per-type particle definitions, see particleInfo
+#define BORDER {BORDER_COLOR, 0                           }
+#define AIR    {AIR_COLOR,    PARTICLE_INVISIBLE          }
+#define SAND   {SAND_COLOR,   PARTICLE_AFFECTED_BY_GRAVITY}
+#define WATER  {WATER_COLOR,  PARTICLE_AFFECTED_BY_GRAVITY}
+#define STONE  {STONE_COLOR,  0                           }
+#define WOOD   {WOOD_COLOR,   PARTICLE_FLAMMABLE          }
+
+// Particle densities. A particle may move into a cell holding a lighter one
+// of these, the others (border, stone, wood) never move or get displaced.
+#define AIR_DENSITY   0
+#define WATER_DENSITY 1
+#define SAND_DENSITY  2
+#define DISPLACES(density) (                      \
+	(AIR_DENSITY   < (density)) << PARTICLE_AIR   | \
+	(WATER_DENSITY < (density)) << PARTICLE_WATER | \
+	(SAND_DENSITY  < (density)) << PARTICLE_SAND)
+
+// Moves {dr, dc} tried in order, see UpdateParticle. MOVE_TIE stays put when
+// both the move and the next one are open, rather than favor one side.
+#define MOVE_TIE true
+#define POWDER_MOVES {{1, 0}, {1, -1}, {1, 1}}
+#define LIQUID_MOVES {{1, 0}, {1, -1, MOVE_TIE}, {1, 1}, {0, -1}, {0, 1}}
+
+// Per-type particle rules, see particleRules
+#define SAND_RULE  {DISPLACES(SAND_DENSITY),  POWDER_MOVES}
+#define WATER_RULE {DISPLACES(WATER_DENSITY), LIQUID_MOVES}
+
+// Every particle type that moves and its rule, the others stay put
+#define PARTICLE_RULES(X)     \
+	X(PARTICLE_SAND,  SAND_RULE)  \
+	X(PARTICLE_WATER, WATER_RULE)
+
+// Cell encoding: particle type in the low bits, per-cell state above it
+#define PARTICLE_TYPE_MASK 0x1f
+#define PARTICLE_UPDATED   (1 << 7)
+
+typedef enum {
+	PARTICLE_BORDER,
+	PARTICLE_AIR,
+	PARTICLE_SAND,
+	PARTICLE_WATER,
+	PARTICLE_STONE,
+	PARTICLE_WOOD,
+	PARTICLE_TYPE_COUNT,
+} ParticleType;
+
+typedef struct {
+	Color color;
+	int flag;
+} ParticleInfo;
+extern const ParticleInfo particleInfo[PARTICLE_TYPE_COUNT];
+
+#define MAX_PARTICLE_MOVES 6
+
+typedef struct {
+	int8_t dr, dc;         // {0, 0} ends the list
+	bool tie;              // stay put if this move and the next are both open
+} ParticleMove;
+
+typedef struct {
+	uint32_t displaces;    // bit per particle type this one may swap with
+	ParticleMove moves[MAX_PARTICLE_MOVES + 1];
+} ParticleRule;
+extern const ParticleRule particleRules[PARTICLE_TYPE_COUNT];
+
+typedef uint8_t Particle;
+Particle GetParticleByType(ParticleType type);
+void SwapParticle(Particle *a, Particle *b);
+static inline ParticleType GetParticleType(Particle particle) { return particle & PARTICLE_TYPE_MASK; }
+static inline ParticleInfo GetParticleInfo(Particle particle) { return particleInfo[GetParticleType(particle)]; }
+static inline bool IsBorder(Particle particle) { return GetParticleType(particle) == PARTICLE_BORDER; }
+static inline bool IsAir(Particle particle) { return GetParticleType(particle) == PARTICLE_AIR; }
+static inline bool IsSand(Particle particle) { return GetParticleType(particle) == PARTICLE_SAND; }
+static inline bool IsWater(Particle particle) { return GetParticleType(particle) == PARTICLE_WATER; }
+static inline bool IsStone(Particle particle) { return GetParticleType(particle) == PARTICLE_STONE; }
+static inline bool IsWood(Particle particle) { return GetParticleType(particle) == PARTICLE_WOOD; }
+
+// Rectangles of one chunk
+typedef struct {
+	Rectangle *recs;
+	Color *colors;
+	size_t len, cap;
+	unsigned version;      // chunk version the rectangles were built from
+	bool valid;
+} PrefabTile;
+
+typedef struct {
+	Rectangle *recs;       // every tile's rectangles, concatenated
+	Color *colors;
+	size_t len, cap;
+	PrefabTile *tiles;     // one per chunk
+	size_t tileCount;
+	uint64_t visited[CHUNK_SIZE]; // scratch of the tile being built
+	bool changed;          // recs changed in the last UpdateCanvasPrefab
+} CanvasPrefab;
+
+// One RGBA color per visible cell, row-major
+typedef struct {
+	Color *pixels;
+	size_t width, height;
+	unsigned *versions;    // chunk versions the pixels were colored at
+	bool valid;            // false until every chunk has been colored
+	bool changed;          // pixels changed in the last UpdateCanvasPixels
+} CanvasPixels;
+
+typedef struct {
+	int x0, y0, x1, y1;    // inclusive cell bounds, empty when x0 > x1
+} DirtyRect;
+#define DIRTY_RECT_EMPTY (DirtyRect){INT_MAX, INT_MAX, INT_MIN, INT_MIN}
+static inline bool IsDirtyRectEmpty(DirtyRect rect) { return rect.x0 > rect.x1; }
+
+// A CHUNK_SIZE square of the canvas. Chunks whose `rect` is empty are asleep
+// and skipped by UpdateParticles until something marks them dirty again.
+typedef struct {
+	DirtyRect rect;        // cells to update this tick
+	DirtyRect next;        // cells to update next tick
+	DirtyRect spill[9];    // marks for the 3x3 neighborhood, merged after each phase
+	unsigned version;      // bumped whenever the chunk's cells may have changed
+	uint16_t counts[PARTICLE_TYPE_COUNT]; // visible cells of each type
+	int16_t spillCounts[9][PARTICLE_TYPE_COUNT]; // count changes merged with `spill`
+} Chunk;
+
+// Per-worker scratch of UpdateParticles
+typedef struct {
+	size_t *moved;         // offsets of cells flagged PARTICLE_UPDATED this tick
+	size_t movedLen, movedCap;
+} CanvasWorker;
+
+typedef struct {
+	Particle *cells;       // contiguous rows, ghost border included
+	size_t width, height;  // visible canvas size in cells
+	size_t stride;         // cells per row in `cells`
+	int particleSize;      // on-screen cell size in pixels
+	Chunk *chunks;         // row-major, chunkCols * chunkRows
+	size_t chunkCols, chunkRows;
+	size_t counts[PARTICLE_TYPE_COUNT]; // visible cells of each type
+	size_t *phaseChunks;   // indices of the chunks updated in the current phase
+	ThreadPool *pool;
+	CanvasWorker *workers; // one per pool worker
+} Canvas;
+// Cell at visible row `r`, column `c`. The ghost border makes
+// r, c in [-CANVAS_PADDING, size + CANVAS_PADDING) addressable as well.
+static inline Particle *CanvasCell(const Canvas *canvas, size_t r, size_t c) {
+	return canvas->cells + (r + CANVAS_PADDING) * canvas->stride +
+		   (c + CANVAS_PADDING);
+}
+
+// State of one chunk update running on a pool worker
+typedef struct {
+	Canvas *canvas;
+	Chunk *chunk;
+	size_t cx, cy;
+	CanvasWorker *worker;
+} ChunkUpdate;
+// clang-format on
+
+// False if the canvas can't be allocated
+bool InitCanvas(Canvas *canvas, size_t width, size_t height, int particleSize,
+				size_t threads);
+
+void FreeCanvas(Canvas *canvas);
+
+void MarkDirty(Canvas *canvas, int r0, int c0, int r1, int c1);
+// Set cells [c0, c1) of visible row `r` to `particle`
+void FillCanvasRow(Canvas *canvas, size_t r, size_t c0, size_t c1,
+				   Particle particle);
+// Count every chunk's cells again, after writing cells directly
+void CountParticles(Canvas *canvas);
+bool HasMobileParticles(const Canvas *canvas);
+
+void MarkChunkDirty(ChunkUpdate *update, int r0, int c0, int r1, int c1);
+
+void MoveParticle(ChunkUpdate *update, size_t r, size_t c, int dr, int dc);
+
+void UpdateParticle(ChunkUpdate *update, size_t r, size_t c);
+
+void UpdateChunk(ChunkUpdate *update);
+
+void UpdateParticles(Canvas *canvas);
+
+// Copy of `canvas` to build render data from while `canvas` moves on. Its
+// own builds run on the calling thread only.
+bool InitCanvasCopy(Canvas *copy, const Canvas *canvas);
+// Bring `copy` up to date with `canvas`, chunk by changed chunk
+void SyncCanvasCopy(Canvas *copy, const Canvas *canvas);
+// Same cells, same checksum
+uint64_t CanvasChecksum(const Canvas *canvas);
+
+void UpdateCanvasPrefab(Canvas *canvas, CanvasPrefab *prefab);
+
+void FreeCanvasPrefab(CanvasPrefab *prefab);
+
+void UpdateCanvasPixels(Canvas *canvas, CanvasPixels *pixels);
+
+void FreeCanvasPixels(CanvasPixels *pixels);
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef OP_LOG_H_
+#define OP_LOG_H_
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "op_queue.h"
+
+// Binary log of the operations a session applied, tagged with the tick they
+// ran before. Replaying it on the same starting canvas rebuilds the same
+// canvas, see RunHeadless.
+//
+// Layout: "SOPL", a version byte, then the header fields and one record per
+// operation. Integers are LEB128 varints, signed ones zigzag encoded. A
+// record is its kind byte (operation type + 1), the tick delta to the
+// previous record and the operation. Brush positions are deltas to the
+// previous brush op. The end record (kind 0) holds the tick delta to the
+// session's last tick and the final canvas checksum.
+
+#define OP_LOG_MAX_SCENE 32
+
+// Starting state of the session
+typedef struct {
+	uint32_t width, height, scale;
+	uint32_t seed;
+	char scene[OP_LOG_MAX_SCENE]; // "" for an empty canvas
+} OpLogHeader;
+
+typedef struct {
+	FILE *file;
+	size_t tick;           // tick of the previous record
+	int x, y;              // position of the previous brush op
+} OpLogWriter;
+
+typedef struct {
+	size_t tick;           // the operation is applied before this tick runs
+	Operation op;
+} OpLogRecord;
+
+typedef struct {
+	OpLogHeader header;
+	OpLogRecord *records;  // in the order they were applied
+	size_t len;
+	size_t ticks;          // ticks the session ran
+	uint64_t checksum;     // CanvasChecksum at the end of the session
+	bool complete;         // false if the end record is missing
+} OpLog;
+
+// False if the file can't be created
+bool OpenOpLog(OpLogWriter *log, const char *path, const OpLogHeader *header);
+void OpLogWrite(OpLogWriter *log, size_t tick, const Operation *op);
+// Write the end record and close the file
+void CloseOpLog(OpLogWriter *log, size_t ticks, uint64_t checksum);
+
+// Read a whole log into memory. False if it can't be read, isn't a log or
+// holds an invalid operation. A log cut short keeps the records before the
+// cut.
+bool LoadOpLog(OpLog *log, const char *path);
+void FreeOpLog(OpLog *log);
+
+#endif
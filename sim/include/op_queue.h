@@ -1,31 +1,65 @@
 #ifndef OP_QUEUE_H_
 #define OP_QUEUE_H_
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stdlib.h>
 
+#define OP_QUEUE_CAPACITY 256  // must be a power of two
+
 typedef enum {
 	OP_BRUSH_SWITCH,
 	OP_BRUSH_DRAW,
+	OP_CANVAS_SAVE,        // write a snapshot, see SaveCanvasSnapshot
 } OperationType;
 
+// What to do with a push while the queue is full
+typedef enum {
+	OP_OVERFLOW_DROP,      // drop the new operation
+	OP_OVERFLOW_COALESCE,  // hold it back, replaced by newer ones like it
+	OP_OVERFLOW_BLOCK,     // wait for the consumer to make room
+} OpOverflowPolicy;
+
 typedef struct {
-	int type;
-	void *data;
-} Operation;
+	int x, y;              // brush cursor position in pixels
+	int fromX, fromY;      // position of the previous op of a drag, else x, y
+	size_t size;           // brush size in cells
+	int type;              // brush particle type
+} BrushOp;
 
-typedef struct QueueNode {
-	Operation op;
-	struct QueueNode *next;
-	struct QueueNode *prev;
-} QueueNode;
+typedef struct {
+	OperationType type;
+	union {
+		BrushOp brush;     // OP_BRUSH_SWITCH, OP_BRUSH_DRAW
+	};
+} Operation;
 
+// Lock-free single producer, single consumer ring buffer of operations.
+// Nothing is allocated after MakeEmptyOpQueue. `head` and `tail` only grow,
+// the slot of an index is index % capacity. Push and Flush belong to the
+// producer thread, Front and Pop to the consumer thread.
 typedef struct {
-	QueueNode *front;
-	QueueNode *back;
-	size_t len;
+	Operation ops[OP_QUEUE_CAPACITY];
+	_Alignas(64) atomic_size_t head; // front operation, moved by the consumer
+	_Alignas(64) atomic_size_t tail; // past the back one, moved by the producer
+
+	// Producer side
+	_Alignas(64) Operation pending;  // coalesced operation waiting for room
+	bool hasPending;
+	size_t dropped;        // operations lost to overflow
+	OpOverflowPolicy overflow;
 } OpQueue;
-OpQueue *MakeEmptyOpQueue();
-void OpQueuePush(OpQueue *queue, Operation op);
+OpQueue *MakeEmptyOpQueue(OpOverflowPolicy overflow);
+void FreeOpQueue(OpQueue *queue);
+// False if the operation was dropped
+bool OpQueuePush(OpQueue *queue, Operation op);
+// Push the coalesced operation if there is room now, false if still held
+bool OpQueueFlush(OpQueue *queue);
+// NULL if the queue is empty
+const Operation *OpQueueFront(OpQueue *queue);
 void OpQueuePop(OpQueue *queue);
-const char *BumpQueue(OpQueue *queue);
+static inline size_t OpQueueLen(OpQueue *queue) {
+	size_t head = atomic_load_explicit(&queue->head, memory_order_acquire);
+	return atomic_load_explicit(&queue->tail, memory_order_acquire) - head;
+}
 
 #endif
@@ -0,0 +1,50 @@
+#ifndef PROFILE_H_
+#define PROFILE_H_
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// Per-phase timings of the latest frames and ticks. Each phase is recorded
+// by one thread only and may be summarized from any thread.
+
+#define PROFILE_SAMPLES 256  // kept per phase, must be a power of two
+
+typedef enum {
+	// Render thread, see MainLoop
+	PHASE_INPUT,           // brush cursor and input to the op queue
+	PHASE_DRAW,            // texture upload and draw calls
+	PHASE_PRESENT,         // EndDrawing, includes waiting for vsync
+	// Simulation thread, see UpdateGameTick
+	PHASE_OPERATIONS,      // HandleOperation
+	PHASE_PARTICLES,       // UpdateParticles
+	PHASE_HAND_OFF,        // HandOffTick, includes waiting for the last build
+	// Render data thread, see RenderDataThread. The simulation thread's on
+	// the web.
+	PHASE_RENDER_DATA,     // BuildRenderFrame
+	PHASE_COUNT,
+} ProfilePhase;
+
+// Ring buffer of the latest samples in nanoseconds
+typedef struct {
+	atomic_uint_least32_t samples[PROFILE_SAMPLES];
+	atomic_size_t len;     // samples recorded so far
+} PhaseSamples;
+
+typedef struct {
+	size_t len;            // samples summarized, at most PROFILE_SAMPLES
+	double min, median, p99, max; // in seconds
+} PhaseStats;
+
+const char *GetPhaseName(ProfilePhase phase);
+
+// Record the time since `start` for `phase` and return the current time,
+// the start of the next phase
+double RecordPhase(ProfilePhase phase, double start);
+
+PhaseStats GetPhaseStats(ProfilePhase phase);
+
+// One row per phase, false if the file can't be written
+bool WritePhaseStatsCsv(const char *path);
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef SCENE_H_
+#define SCENE_H_
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "canvas.h"
+
+// Fill `canvas` with a built-in scene, the same seed always builds the same
+// scene. Returns false if no scene is called `name`.
+bool LoadScene(Canvas *canvas, const char *name, unsigned seed);
+size_t GetSceneCount();
+const char *GetSceneName(size_t index);
+
+#endif
@@ -1,8 +1,12 @@
 #ifndef SIM_H_
 #define SIM_H_ 1
 
+#include <stdbool.h>
 #include <stdlib.h>
 
+#include "brush.h"
+#include "canvas.h"
+#include "op_queue.h"
 #include "raylib.h"
 
 // clang-format off
@@ -12,37 +16,12 @@
 
 #define TARGET_TICKRATE 64
 
+// Defaults, overridden from the command line
 #define PARTICLE_SIZE 2
-#define CANVAS_SIZE   300
-
-#define BORDER_COLOR (Color){255, 255, 255, 255}     // White
-#define AIR_COLOR    (Color){0, 0, 0, 0}             // Transparent
-#define SAND_COLOR   (Color){255, 255, 51, 255}      // Yellow
-#define WATER_COLOR  (Color){0, 121, 241, 255}       // Blue
-#define STONE_COLOR  (Color){128, 128, 128, 255}     // Grey
-#define WOOD_COLOR   (Color){139, 69, 19, 255}       // Brown
-
-// Particle properties
-#define PARTICLE_INVISIBLE            (1 << 0)
-#define PARTICLE_AFFECTED_BY_GRAVITY  (1 << 1)
-#define PARTICLE_FLAMMABLE            (1 << 2)
-#define PARTICLE_EXPLOSIVE            (1 << 3)
-
-#define BORDER (Particle){PARTICLE_BORDER, BORDER_COLOR, 0,                            false}
-#define AIR    (Particle){PARTICLE_AIR,    AIR_COLOR,    PARTICLE_INVISIBLE,           false}
-#define SAND   (Particle){PARTICLE_SAND,   SAND_COLOR,   PARTICLE_AFFECTED_BY_GRAVITY, false}
-#define WATER  (Particle){PARTICLE_WATER,  WATER_COLOR,  PARTICLE_AFFECTED_BY_GRAVITY, false}
-#define STONE  (Particle){PARTICLE_STONE,  STONE_COLOR,  0,                            false}
-#define WOOD   (Particle){PARTICLE_WOOD,   WOOD_COLOR,   PARTICLE_FLAMMABLE,           false}
-
-typedef enum {
-	PARTICLE_BORDER,
-	PARTICLE_AIR,
-	PARTICLE_SAND,
-	PARTICLE_WATER,
-	PARTICLE_STONE,
-	PARTICLE_WOOD,
-} ParticleType;
+#define CANVAS_WIDTH  300
+#define CANVAS_HEIGHT 300
+#define SNAPSHOT_PATH "canvas.snap"
+#define MAX_TICKS_PER_FRAME 4
 
 typedef struct {
 	bool showBrushSize;
@@ -52,8 +31,65 @@ typedef struct {
 	bool showBrushInfo;
 	bool showCanvasPrefabInfo;
 	bool showOpQueueInfo;
+	bool showTickInfo;
+	bool showParticleCounts;
+	bool showPhaseTimes;
 } DebugInfo;
 
+typedef enum {
+	RENDER_TEXTURE,        // cell colors uploaded to one texture per tick
+	RENDER_PREFAB,         // one rectangle per run of same-type cells
+} RenderMode;
+
+typedef struct {
+	size_t width, height;  // canvas size in cells
+	size_t scale;          // on-screen particle size in pixels
+	bool headless;         // run without a window, see RunHeadless
+	size_t ticks;          // ticks to run when headless
+	const char *scene;     // scene loaded at startup, NULL for an empty canvas
+	unsigned seed;         // scene seed
+	size_t threads;        // simulation workers, 0 for one per CPU
+	RenderMode render;
+	OpOverflowPolicy opOverflow; // brush input while the op queue is full
+	const char *record;    // op log written during the session, or NULL
+	const char *replay;    // op log replayed headless, or NULL
+	const char *load;      // snapshot loaded instead of a scene, or NULL
+	const char *save;      // where snapshots are saved, NULL for SNAPSHOT_PATH
+	const char *profile;   // phase timings CSV written on exit, or NULL
+	const char *trace;     // trace event JSON written on exit, or NULL
+	size_t maxTicks;       // catch-up ticks per frame before dropping
+} Options;
+
+typedef struct {
+	size_t ticks;
+	double particles;      // seconds spent in UpdateParticles
+	double render;         // seconds spent building the render data
+	double handOff;        // seconds spent handing ticks over to be rendered
+} TickStats;
+
+typedef struct {
+	float x, y;
+	Color color;
+} PrefabVertex;
+
+// GPU copy of the canvas prefab, two triangles per rectangle
+typedef struct {
+	PrefabVertex *vertices; // staging copy of the vertex buffer
+	size_t len, cap;        // in vertices
+	unsigned int vao, vbo;
+	unsigned long version;  // RenderFrame version uploaded last
+} PrefabMesh;
+
+// What the render thread needs of a tick. The simulation thread builds one
+// while the render thread draws another, see PublishRenderFrame.
+typedef struct {
+	CanvasPixels pixels;    // RENDER_TEXTURE
+	CanvasPrefab prefab;    // RENDER_PREFAB
+	unsigned long version;  // changes whenever the content does
+	size_t tick;            // ticks done when the frame was built
+	size_t counts[PARTICLE_TYPE_COUNT]; // particles of each type
+} RenderFrame;
+
 typedef struct {
 	int x, y;
 } IntVec2;
@@ -62,65 +98,66 @@ typedef struct {
 	IntVec2 position;  // brush cursor location
 	Color color;       // brush particle color
 	size_t size;       // brush size
-	size_t p_count;    // brush particle points count
-	IntVec2 *points;   // brush particle points
+	const BrushStamp *stamp; // brush cells, NULL until UpdateBrushCursor
 	ParticleType type; // brush particle type
 } BrushCursor;
 void SwitchBrushType(BrushCursor *cursor, ParticleType type);
 
+// Brush swept from one cursor position to the next, in pixels
 typedef struct {
-	ParticleType type;
-	Color color;
-	int flag;
-	bool updated;
-} Particle;
-inline Particle GetParticleByType(ParticleType type);
-inline void SwapParticle(Particle *a, Particle *b);
-inline bool IsBorder(Particle particle) { return particle.type == PARTICLE_BORDER; }
-inline bool IsAir(Particle particle) { return particle.type == PARTICLE_AIR; }
-inline bool IsSand(Particle particle) { return particle.type == PARTICLE_SAND; }
-inline bool IsWater(Particle particle) { return particle.type == PARTICLE_WATER; }
-inline bool IsStone(Particle particle) { return particle.type == PARTICLE_STONE; }
-inline bool IsWood(Particle particle) { return particle.type == PARTICLE_WOOD; }
-
+	IntVec2 from, to;
+} BrushSegment;
 
+// Consecutive brush draws of one size and type, written to the canvas at
+// once by BrushDraw
 typedef struct {
-	Rectangle *recs;
-	Color *colors;
+	const BrushStamp *stamp; // shape of every stamp
+	ParticleType type;
+	BrushSegment segments[OP_QUEUE_CAPACITY];
 	size_t len;
-} CanvasPrefab;
+	uint8_t *mask;         // scratch, cells covered in the stroke's bounds
+	size_t maskCap;
+	int *rowMin, *rowMax;  // scratch, extent of one segment per mask row
+	size_t rowCap;
+	BrushStampCache stamps;
+} BrushStroke;
 
-typedef struct {
-	Particle **particles;
-	size_t width, height;
-} Canvas;
+bool ParseOptions(int argc, char **argv, Options *options);
+
+int RunHeadless();
 
 void MainLoop();
 
 void UpdateGameTick();
 
+void BuildRenderFrame(Canvas *source, RenderFrame *frame, size_t tick);
+
+void PublishRenderFrame();
+
+const RenderFrame *AcquireRenderFrame();
+
 void HandleOperation();
 
 void UpdateBrushCursor(BrushCursor *cursor);
 
 void HandleBrushOperation();
 
-void UpdateSand(Canvas *canvas, size_t r, size_t c);
+void DrawBrushCursor(BrushCursor cursor);
 
-void UpdateWater(Canvas *canvas, size_t r, size_t c);
+void UnloadBrushTexture();
 
-void UpdateParticles(Canvas *canvas);
+bool AddBrushStamp(BrushStroke *stroke, const BrushOp *op);
 
-void UpdateCanvasPrefab(Canvas *canvas);
+void BrushDraw(BrushStroke *stroke, Canvas *canvas);
 
-void DrawBrushCursor(BrushCursor cursor);
+void UploadPrefabMesh(PrefabMesh *mesh, const CanvasPrefab *prefab);
 
-void BrushDraw(BrushCursor cursor, Canvas *canvas);
+void UnloadPrefabMesh(PrefabMesh *mesh);
 
-void InitCanvas(size_t width, size_t height);
+void DrawCanvasPrefab(PrefabMesh *mesh, const RenderFrame *frame);
 
-void DrawCanvasPrefab(CanvasPrefab canvasPrefab);
+void DrawCanvasTexture(const RenderFrame *frame);
 
-void DrawDebugInfo(BrushCursor cursor);
+void DrawDebugInfo(BrushCursor cursor, const RenderFrame *frame);
 
 #endif
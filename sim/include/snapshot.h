@@ -0,0 +1,42 @@
+#ifndef SNAPSHOT_H_
+#define SNAPSHOT_H_
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "canvas.h"
+
+// Binary copy of a canvas' cells. The file is a SnapshotHeader, an index of
+// one SnapshotChunk per chunk, row-major, then every chunk's cells. A chunk
+// holds its visible cells row by row as runs, each run a particle type byte
+// followed by its length - 1, so an empty chunk takes a few bytes. Integers
+// are stored in native byte order.
+
+#define SNAPSHOT_MAGIC   "SCNV"
+#define SNAPSHOT_VERSION 1
+
+typedef struct {
+	char magic[4];
+	uint32_t version;
+	uint32_t width, height;  // in cells
+	uint32_t chunkSize;      // edge length of a stored chunk in cells
+	uint32_t chunkCols, chunkRows;
+	uint32_t reserved;
+} SnapshotHeader;
+
+typedef struct {
+	uint64_t offset;         // from the start of the file
+	uint64_t len;            // in bytes
+} SnapshotChunk;
+
+// False if the file can't be written
+bool SaveCanvasSnapshot(const Canvas *canvas, const char *path);
+
+// InitCanvas with the size and cells of the snapshot at `path`. The file is
+// mapped and its chunks are decoded in parallel, straight from the mapping.
+// False if it can't be read or isn't a valid snapshot, `canvas` is left
+// uninitialized then.
+bool LoadCanvasSnapshot(Canvas *canvas, const char *path, int particleSize,
+						size_t threads);
+
+#endif
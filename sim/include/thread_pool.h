@@ -0,0 +1,18 @@
+#ifndef THREAD_POOL_H_
+#define THREAD_POOL_H_
+#include <stdlib.h>
+
+// Runs task(ctx, index, worker) for every index in [0, count). `worker` is in
+// [0, ThreadPoolWorkers(pool)) and unique among concurrently running tasks.
+typedef void (*ThreadPoolTask)(void *ctx, size_t index, size_t worker);
+
+typedef struct ThreadPool ThreadPool;
+// `workers` counts the calling thread, 0 picks one per online CPU
+ThreadPool *MakeThreadPool(size_t workers);
+void FreeThreadPool(ThreadPool *pool);
+size_t ThreadPoolWorkers(const ThreadPool *pool);
+// Blocks until every index has been run
+void ThreadPoolRun(ThreadPool *pool, ThreadPoolTask task, void *ctx,
+				   size_t count);
+
+#endif
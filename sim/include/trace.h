@@ -0,0 +1,27 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+#include <stdatomic.h>
+#include <stdbool.h>
+
+// Chrome trace event JSON, viewable in chrome://tracing or Perfetto. Every
+// thread appends events to a buffer of its own, full buffers are formatted
+// and written by a background thread. Event names must outlive the trace,
+// string literals in practice. All calls are cheap no-ops unless tracing.
+
+extern atomic_bool tracing;
+static inline bool IsTracing() {
+	return atomic_load_explicit(&tracing, memory_order_relaxed);
+}
+
+// False if the file can't be created
+bool StartTrace(const char *path);
+// Write out every buffered event. The other threads must be done tracing.
+void StopTrace();
+
+// Name the calling thread in the timeline
+void TraceThreadName(const char *name);
+// Span of `name` from `start` to `end`, in GetMonotonicTime seconds
+void TraceSpan(const char *name, double start, double end);
+void TraceCounter(const char *name, double value);
+
+#endif
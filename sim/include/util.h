@@ -3,4 +3,9 @@
 
 float Hypotenuse(float a, float b);
 
+// Seconds on a monotonic clock, usable without a window
+double GetMonotonicTime();
+
+void SleepSeconds(double seconds);
+
 #endif
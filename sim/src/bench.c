@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "canvas.h"
+#include "scene.h"
+#include "snapshot.h"
+#include "util.h"
+
+// Microbenchmark of the simulation kernel, see `make bench`. Every built-in
+// scene runs at every canvas size, or a snapshot at its own size, and one
+// CSV row is printed per phase.
+
+#define MAX_BENCH_SIZES 16
+
+typedef struct {
+	size_t ticks;          // timed ticks per run
+	size_t threads;        // simulation workers, 0 for one per CPU
+	unsigned seed;         // scene seed
+	size_t sizes[MAX_BENCH_SIZES];
+	size_t sizeCount;
+	const char *load;      // snapshot run instead of the scenes, or NULL
+} BenchOptions;
+
+static int CompareDouble(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+// Sorts `samples` in place
+static double Percentile(double *samples, size_t len, double p) {
+	qsort(samples, len, sizeof(double), CompareDouble);
+	size_t i = (size_t)(p * (len - 1) + 0.5);
+	return samples[i];
+}
+
+static void PrintRow(const char *scene, const Canvas *canvas,
+					 const char *phase, double *samples, size_t len) {
+	double median = Percentile(samples, len, 0.5);
+	double p99 = Percentile(samples, len, 0.99);
+	double cells = (double)canvas->width * canvas->height;
+	printf("%s,%zu,%zu,%zu,%s,%zu,%.4f,%.4f,%.0f\n", scene, canvas->width,
+		   canvas->height, ThreadPoolWorkers(canvas->pool), phase, len,
+		   median * 1e3, p99 * 1e3, median > 0 ? cells / median : 0);
+	fflush(stdout);
+}
+
+// Frees `canvas` when done
+static void RunBench(const BenchOptions *options, const char *scene,
+					 Canvas *canvas, double *particles, double *prefabs,
+					 double *pixels) {
+	CanvasPrefab prefab = {0};
+	CanvasPixels canvasPixels = {0};
+
+	// The prefab and pixels start out empty and are built whole on the
+	// first tick, which would skew p99. Only steady state ticks are timed.
+	UpdateParticles(canvas);
+	UpdateCanvasPrefab(canvas, &prefab);
+	UpdateCanvasPixels(canvas, &canvasPixels);
+
+	for (size_t i = 0; i < options->ticks; ++i) {
+		double start = GetMonotonicTime();
+		UpdateParticles(canvas);
+		double mid = GetMonotonicTime();
+		UpdateCanvasPrefab(canvas, &prefab);
+		double end = GetMonotonicTime();
+		UpdateCanvasPixels(canvas, &canvasPixels);
+		particles[i] = mid - start;
+		prefabs[i] = end - mid;
+		pixels[i] = GetMonotonicTime() - end;
+	}
+
+	PrintRow(scene, canvas, "UpdateParticles", particles, options->ticks);
+	PrintRow(scene, canvas, "UpdateCanvasPrefab", prefabs, options->ticks);
+	PrintRow(scene, canvas, "UpdateCanvasPixels", pixels, options->ticks);
+	FreeCanvasPixels(&canvasPixels);
+	FreeCanvasPrefab(&prefab);
+	FreeCanvas(canvas);
+}
+
+static bool ParseSizes(const char *value, BenchOptions *options) {
+	options->sizeCount = 0;
+	while (*value != '\0' && options->sizeCount < MAX_BENCH_SIZES) {
+		char *end;
+		size_t size = strtoul(value, &end, 10);
+		if (end == value || size < 3 || size > MAX_CANVAS_SIZE) return false;
+		options->sizes[options->sizeCount++] = size;
+		value = *end == ',' ? end + 1 : end;
+		if (*end != ',' && *end != '\0') return false;
+	}
+	return options->sizeCount > 0;
+}
+
+int main(int argc, char **argv) {
+	BenchOptions options = {
+		.ticks = 200, .sizes = {256, 1024, 2048}, .sizeCount = 3};
+	for (int i = 1; i < argc; ++i) {
+		const char *arg = argv[i];
+		const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+		if (strcmp(arg, "--ticks") == 0 && value != NULL) {
+			options.ticks = strtoul(value, NULL, 10), ++i;
+		} else if (strcmp(arg, "--threads") == 0 && value != NULL) {
+			options.threads = strtoul(value, NULL, 10), ++i;
+		} else if (strcmp(arg, "--seed") == 0 && value != NULL) {
+			options.seed = strtoul(value, NULL, 10), ++i;
+		} else if (strcmp(arg, "--sizes") == 0 && value != NULL &&
+				   ParseSizes(value, &options)) {
+			++i;
+		} else if (strcmp(arg, "--load") == 0 && value != NULL) {
+			options.load = value, ++i;
+		} else {
+			fprintf(stderr,
+					"Usage: %s [--ticks N] [--threads N] [--seed N] "
+					"[--sizes N,N,...] [--load FILE]\n",
+					argv[0]);
+			return 1;
+		}
+	}
+	if (options.ticks < 1) options.ticks = 1;
+
+	double *particles = malloc(sizeof(double) * options.ticks);
+	double *prefabs = malloc(sizeof(double) * options.ticks);
+	double *pixels = malloc(sizeof(double) * options.ticks);
+	printf("scene,width,height,threads,phase,ticks,median_ms,p99_ms,"
+		   "cells_per_s\n");
+	Canvas canvas;
+	int status = 0;
+	if (options.load != NULL) {
+		if (LoadCanvasSnapshot(&canvas, options.load, 1, options.threads)) {
+			RunBench(&options, options.load, &canvas, particles, prefabs,
+					 pixels);
+		} else {
+			fprintf(stderr, "Can't load snapshot %s\n", options.load);
+			status = 1;
+		}
+	}
+	for (size_t s = 0; options.load == NULL && s < options.sizeCount; ++s) {
+		for (size_t i = 0; i < GetSceneCount(); ++i) {
+			size_t size = options.sizes[s];
+			if (!InitCanvas(&canvas, size, size, 1, options.threads)) {
+				fprintf(stderr, "Can't allocate a %zux%zu canvas\n", size,
+						size);
+				status = 1;
+				continue;
+			}
+			LoadScene(&canvas, GetSceneName(i), options.seed);
+			RunBench(&options, GetSceneName(i), &canvas, particles, prefabs,
+					 pixels);
+		}
+	}
+	free(pixels);
+	free(prefabs);
+	free(particles);
+	return status;
+}
@@ -0,0 +1,61 @@
+#include "brush.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "util.h"
+
+// Rasterize the circle into a size x size mask, then split its rows into
+// spans. A quarter is tested and mirrored onto the other three.
+static void BuildBrushStamp(BrushStamp *stamp, size_t size) {
+	bool *mask = calloc(size * size, sizeof(bool));
+	float radius = size / 2.0;
+	for (int i = 0; i < radius; ++i) {
+		for (int j = 0; j < radius; ++j) {
+			float distance = Hypotenuse(radius - i, radius - j);
+			// Odd size & even size
+			if ((size & 1 ? floorf(distance) : roundf(distance)) > radius) {
+				continue;
+			}
+			mask[j * size + i] = true;
+			mask[j * size + (size - i - 1)] = true;
+			mask[(size - j - 1) * size + i] = true;
+			mask[(size - j - 1) * size + (size - i - 1)] = true;
+		}
+	}
+
+	// A circle covers a single run of each row
+	stamp->size = size;
+	stamp->spans = malloc(sizeof(BrushSpan) * size);
+	stamp->len = 0;
+	for (size_t r = 0; r < size; ++r) {
+		for (size_t c = 0; c < size; ++c) {
+			if (!mask[r * size + c]) continue;
+			size_t start = c;
+			while (c < size && mask[r * size + c]) ++c;
+			stamp->spans[stamp->len++] = (BrushSpan){r, start, c - start};
+		}
+	}
+	free(mask);
+}
+
+const BrushStamp *GetBrushStamp(BrushStampCache *cache, size_t size) {
+	if (size >= cache->cap) {
+		size_t cap = cache->cap ? cache->cap : 16;
+		while (cap <= size) cap *= 2;
+		cache->stamps = realloc(cache->stamps, sizeof(BrushStamp) * cap);
+		memset(cache->stamps + cache->cap, 0,
+			   sizeof(BrushStamp) * (cap - cache->cap));
+		cache->cap = cap;
+	}
+	BrushStamp *stamp = &cache->stamps[size];
+	if (stamp->spans == NULL) BuildBrushStamp(stamp, size);
+	return stamp;
+}
+
+void FreeBrushStampCache(BrushStampCache *cache) {
+	for (size_t i = 0; i < cache->cap; ++i) free(cache->stamps[i].spans);
+	free(cache->stamps);
+	*cache = (BrushStampCache){0};
+}
@@ -0,0 +1,664 @@
+#include "canvas.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+const ParticleInfo particleInfo[PARTICLE_TYPE_COUNT] = {
+	[PARTICLE_BORDER] = BORDER, [PARTICLE_AIR] = AIR,
+	[PARTICLE_SAND] = SAND,     [PARTICLE_WATER] = WATER,
+	[PARTICLE_STONE] = STONE,   [PARTICLE_WOOD] = WOOD,
+};
+
+#define RULE_ENTRY(type, rule) [type] = rule,
+const ParticleRule particleRules[PARTICLE_TYPE_COUNT] = {
+	PARTICLE_RULES(RULE_ENTRY)
+};
+
+// Bit per particle type with a rule
+_Static_assert(PARTICLE_TYPE_COUNT <= 32, "particle type masks are 32 bits");
+#define RULE_BIT(type, rule) | 1u << (type)
+static const uint32_t mobileParticles = 0 PARTICLE_RULES(RULE_BIT);
+
+Particle GetParticleByType(ParticleType type) {
+	return type < PARTICLE_TYPE_COUNT ? (Particle)type : PARTICLE_AIR;
+}
+
+void SwapParticle(Particle *a, Particle *b) {
+	Particle tmp = *a;
+	*a = *b, *b = tmp;
+}
+
+static inline void ExtendDirtyRect(DirtyRect *rect, int y0, int x0, int y1,
+								   int x1) {
+	if (y0 < rect->y0) rect->y0 = y0;
+	if (y1 > rect->y1) rect->y1 = y1;
+	if (x0 < rect->x0) rect->x0 = x0;
+	if (x1 > rect->x1) rect->x1 = x1;
+}
+
+// Clamp [r0, r1] x [c0, c1] to the canvas, false if nothing is left
+static inline bool ClampToCanvas(const Canvas *canvas, int *r0, int *c0,
+								 int *r1, int *c1) {
+	if (*r0 < 0) *r0 = 0;
+	if (*c0 < 0) *c0 = 0;
+	if (*r1 >= (int)canvas->height) *r1 = canvas->height - 1;
+	if (*c1 >= (int)canvas->width) *c1 = canvas->width - 1;
+	return *r0 <= *r1 && *c0 <= *c1;
+}
+
+// Clamp [r0, r1] x [c0, c1] to chunk (cy, cx) into `out`
+static inline void ClampToChunk(int cy, int cx, int r0, int c0, int r1, int c1,
+								DirtyRect *out) {
+	out->y0 = cy * CHUNK_SIZE, out->y1 = out->y0 + CHUNK_SIZE - 1;
+	out->x0 = cx * CHUNK_SIZE, out->x1 = out->x0 + CHUNK_SIZE - 1;
+	if (r0 > out->y0) out->y0 = r0;
+	if (r1 < out->y1) out->y1 = r1;
+	if (c0 > out->x0) out->x0 = c0;
+	if (c1 < out->x1) out->x1 = c1;
+}
+
+// Mark cells [r0, r1] x [c0, c1] to be updated for the rest of this tick and
+// the next one, waking every chunk the box overlaps.
+void MarkDirty(Canvas *canvas, int r0, int c0, int r1, int c1) {
+	if (!ClampToCanvas(canvas, &r0, &c0, &r1, &c1)) return;
+
+	for (int cy = r0 / CHUNK_SIZE; cy <= r1 / CHUNK_SIZE; ++cy) {
+		for (int cx = c0 / CHUNK_SIZE; cx <= c1 / CHUNK_SIZE; ++cx) {
+			Chunk *chunk = &canvas->chunks[cy * canvas->chunkCols + cx];
+			DirtyRect box;
+			ClampToChunk(cy, cx, r0, c0, r1, c1, &box);
+			ExtendDirtyRect(&chunk->rect, box.y0, box.x0, box.y1, box.x1);
+			ExtendDirtyRect(&chunk->next, box.y0, box.x0, box.y1, box.x1);
+			++chunk->version;
+		}
+	}
+}
+
+// Visible cells [y0, y1) x [x0, x1) of chunk `i`
+static inline void GetChunkBounds(const Canvas *canvas, size_t i, size_t *y0,
+								  size_t *x0, size_t *y1, size_t *x1) {
+	*y0 = i / canvas->chunkCols * CHUNK_SIZE;
+	*x0 = i % canvas->chunkCols * CHUNK_SIZE;
+	*y1 = *y0 + CHUNK_SIZE < canvas->height ? *y0 + CHUNK_SIZE : canvas->height;
+	*x1 = *x0 + CHUNK_SIZE < canvas->width ? *x0 + CHUNK_SIZE : canvas->width;
+}
+
+// Counts cell by cell for the cells overwritten, so a brush costs as much as
+// the area it covers
+void FillCanvasRow(Canvas *canvas, size_t r, size_t c0, size_t c1,
+				   Particle particle) {
+	Particle *row = CanvasCell(canvas, r, 0);
+	Chunk *chunks = canvas->chunks + r / CHUNK_SIZE * canvas->chunkCols;
+	ParticleType type = GetParticleType(particle);
+	for (size_t c = c0; c < c1;) {
+		Chunk *chunk = &chunks[c / CHUNK_SIZE];
+		size_t end = (c / CHUNK_SIZE + 1) * CHUNK_SIZE;
+		if (end > c1) end = c1;
+		for (size_t i = c; i < end; ++i) {
+			--chunk->counts[GetParticleType(row[i])];
+			--canvas->counts[GetParticleType(row[i])];
+		}
+		chunk->counts[type] += end - c;
+		canvas->counts[type] += end - c;
+		c = end;
+	}
+	memset(row + c0, particle, c1 - c0);
+}
+
+static void CountChunkTask(void *ctx, size_t index, size_t worker) {
+	(void)worker;
+	Canvas *canvas = ctx;
+	Chunk *chunk = &canvas->chunks[index];
+	size_t y0, x0, y1, x1;
+	GetChunkBounds(canvas, index, &y0, &x0, &y1, &x1);
+	memset(chunk->counts, 0, sizeof(chunk->counts));
+	for (size_t r = y0; r < y1; ++r) {
+		const Particle *row = CanvasCell(canvas, r, 0);
+		for (size_t c = x0; c < x1; ++c) {
+			++chunk->counts[GetParticleType(row[c])];
+		}
+	}
+}
+
+void CountParticles(Canvas *canvas) {
+	_Static_assert(CHUNK_SIZE * CHUNK_SIZE <= UINT16_MAX,
+				   "chunk counts must fit 16 bits");
+	size_t chunkCount = canvas->chunkCols * canvas->chunkRows;
+	ThreadPoolRun(canvas->pool, CountChunkTask, canvas, chunkCount);
+	memset(canvas->counts, 0, sizeof(canvas->counts));
+	for (size_t i = 0; i < chunkCount; ++i) {
+		for (int t = 0; t < PARTICLE_TYPE_COUNT; ++t) {
+			canvas->counts[t] += canvas->chunks[i].counts[t];
+		}
+	}
+}
+
+// Moves only swap particles, so the canvas totals change with brushes alone
+bool HasMobileParticles(const Canvas *canvas) {
+	for (int t = 0; t < PARTICLE_TYPE_COUNT; ++t) {
+		if (mobileParticles >> t & 1 && canvas->counts[t] > 0) return true;
+	}
+	return false;
+}
+
+static inline bool HasMobileChunkParticles(const Chunk *chunk) {
+	for (int t = 0; t < PARTICLE_TYPE_COUNT; ++t) {
+		if (mobileParticles >> t & 1 && chunk->counts[t] > 0) return true;
+	}
+	return false;
+}
+
+// MarkDirty from inside a chunk update. Chunks updated in the same phase may
+// mark the same neighbor, so marks outside the updating chunk are kept in its
+// spill and merged by UpdateParticles once the phase is over.
+void MarkChunkDirty(ChunkUpdate *update, int r0, int c0, int r1, int c1) {
+	if (!ClampToCanvas(update->canvas, &r0, &c0, &r1, &c1)) return;
+
+	for (int cy = r0 / CHUNK_SIZE; cy <= r1 / CHUNK_SIZE; ++cy) {
+		for (int cx = c0 / CHUNK_SIZE; cx <= c1 / CHUNK_SIZE; ++cx) {
+			DirtyRect box;
+			ClampToChunk(cy, cx, r0, c0, r1, c1, &box);
+			if (cy == (int)update->cy && cx == (int)update->cx) {
+				Chunk *chunk = update->chunk;
+				ExtendDirtyRect(&chunk->rect, box.y0, box.x0, box.y1, box.x1);
+				ExtendDirtyRect(&chunk->next, box.y0, box.x0, box.y1, box.x1);
+			} else {
+				int dy = cy - (int)update->cy, dx = cx - (int)update->cx;
+				DirtyRect *spill = &update->chunk->spill[(dy + 1) * 3 + dx + 1];
+				ExtendDirtyRect(spill, box.y0, box.x0, box.y1, box.x1);
+			}
+		}
+	}
+}
+
+// Swap the particle at (r, c) with its neighbor at (r + dr, c + dc) and flag
+// it as updated for the rest of the tick. Only flagged cells are recorded, so
+// the flags are cleared without another walk over the whole canvas.
+void MoveParticle(ChunkUpdate *update, size_t r, size_t c, int dr, int dc) {
+	Canvas *canvas = update->canvas;
+	CanvasWorker *worker = update->worker;
+	Particle *src = CanvasCell(canvas, r, c);
+	Particle *dst = src + dr * (ptrdiff_t)canvas->stride + dc;
+
+	// Swaps only change counts when they cross into another chunk. The
+	// neighbor's share goes through the spill like its dirty marks.
+	int dy = (int)((r + dr) / CHUNK_SIZE) - (int)update->cy;
+	int dx = (int)((c + dc) / CHUNK_SIZE) - (int)update->cx;
+	if (dy | dx) {
+		ParticleType moving = GetParticleType(*src);
+		ParticleType displaced = GetParticleType(*dst);
+		int16_t *spill = update->chunk->spillCounts[(dy + 1) * 3 + dx + 1];
+		--update->chunk->counts[moving], ++update->chunk->counts[displaced];
+		++spill[moving], --spill[displaced];
+	}
+	SwapParticle(src, dst);
+	*src &= ~PARTICLE_UPDATED;
+	*dst |= PARTICLE_UPDATED;
+
+	if (worker->movedLen == worker->movedCap) {
+		worker->movedCap = worker->movedCap ? worker->movedCap * 2 : 1024;
+		worker->moved =
+			realloc(worker->moved, sizeof(size_t) * worker->movedCap);
+	}
+	worker->moved[worker->movedLen++] = dst - canvas->cells;
+
+	// Both cells and everything around them may move next tick
+	MarkChunkDirty(update, (int)r - 1, (int)c - (dc < 0) - 1, (int)r + dr + 1,
+				   (int)c + (dc > 0) + 1);
+}
+
+static inline bool CanDisplace(const ParticleRule *rule, Particle particle) {
+	return rule->displaces >> GetParticleType(particle) & 1;
+}
+
+// Take the first open move of `rule` for the particle at (r, c). Only ever
+// called with a constant rule, so the compiler unrolls the moves into a
+// fixed chain of compares like a hand-written kernel.
+static inline void ApplyRule(ChunkUpdate *update, size_t r, size_t c,
+							 const ParticleRule *rule) {
+	// The ghost border never gets displaced, so no bounds checks needed
+	const ptrdiff_t s = update->canvas->stride;
+	Particle *p = CanvasCell(update->canvas, r, c);
+	for (int i = 0; i < MAX_PARTICLE_MOVES; ++i) {
+		const ParticleMove *move = &rule->moves[i];
+		if (!(move->dr | move->dc)) return;
+		if (!CanDisplace(rule, p[move->dr * s + move->dc])) continue;
+		if (move->tie && CanDisplace(rule, p[move[1].dr * s + move[1].dc])) {
+			return;
+		}
+		MoveParticle(update, r, c, move->dr, move->dc);
+		// The displaced particle, now at (r, c), moves on its own right away.
+		// Densities only drop along the way, so this ends.
+		if (mobileParticles >> GetParticleType(*p) & 1) {
+			UpdateParticle(update, r, c);
+		}
+		return;
+	}
+}
+
+#define RULE_CASE(type, rule)                      \
+	case type:                                     \
+		ApplyRule(update, r, c, &particleRules[type]); \
+		break;
+
+void UpdateParticle(ChunkUpdate *update, size_t r, size_t c) {
+	switch (GetParticleType(*CanvasCell(update->canvas, r, c))) {
+		PARTICLE_RULES(RULE_CASE)
+		default:
+			break;
+	}
+}
+
+// Rows bottom up, cells left to right, re-reading the rect as moves grow it
+void UpdateChunk(ChunkUpdate *update) {
+	const DirtyRect *rect = &update->chunk->rect;
+	for (int r = rect->y1; r >= rect->y0; --r) {
+		Particle *row = CanvasCell(update->canvas, r, 0);
+		for (int c = rect->x0; c <= rect->x1; ++c) {
+			if (row[c] & PARTICLE_UPDATED) continue;
+			if (mobileParticles >> GetParticleType(row[c]) & 1) {
+				UpdateParticle(update, r, c);
+			}
+		}
+	}
+}
+
+static void UpdateChunkTask(void *ctx, size_t index, size_t worker) {
+	Canvas *canvas = ctx;
+	size_t i = canvas->phaseChunks[index];
+	ChunkUpdate update = {
+		.canvas = canvas,
+		.chunk = &canvas->chunks[i],
+		.cx = i % canvas->chunkCols,
+		.cy = i / canvas->chunkCols,
+		.worker = &canvas->workers[worker],
+	};
+	UpdateChunk(&update);
+}
+
+// Chunks are updated in four checkerboard phases. A chunk update reads and
+// writes at most one cell past its chunk, so chunks of the same phase never
+// touch each other's cells and run in parallel. The phase order is fixed,
+// making the result independent of the number of workers.
+void UpdateParticles(Canvas *canvas) {
+	_Static_assert(CHUNK_SIZE >= 3, "chunks must be wider than two cells");
+	size_t chunkCount = canvas->chunkCols * canvas->chunkRows;
+	for (size_t i = 0; i < chunkCount; ++i) {
+		canvas->chunks[i].rect = canvas->chunks[i].next;
+		canvas->chunks[i].next = DIRTY_RECT_EMPTY;
+	}
+	// Nothing can move, every chunk goes back to sleep
+	if (!HasMobileParticles(canvas)) return;
+
+	for (size_t phase = 0; phase < 4; ++phase) {
+		size_t len = 0;
+		for (size_t cy = phase >> 1; cy < canvas->chunkRows; cy += 2) {
+			for (size_t cx = phase & 1; cx < canvas->chunkCols; cx += 2) {
+				// A chunk without mobile particles has nothing to update,
+				// whatever moves in during this phase is merged after it
+				size_t i = cy * canvas->chunkCols + cx;
+				if (!IsDirtyRectEmpty(canvas->chunks[i].rect) &&
+					HasMobileChunkParticles(&canvas->chunks[i])) {
+					canvas->phaseChunks[len++] = i;
+				}
+			}
+		}
+		if (!len) continue;
+
+		ThreadPoolRun(canvas->pool, UpdateChunkTask, canvas, len);
+
+		// Hand the spilled marks to the neighbors, later phases still see
+		// them this tick
+		for (size_t j = 0; j < len; ++j) {
+			Chunk *chunk = &canvas->chunks[canvas->phaseChunks[j]];
+			for (int k = 0; k < 9; ++k) {
+				DirtyRect spill = chunk->spill[k];
+				if (IsDirtyRectEmpty(spill)) continue;
+				ptrdiff_t offset = (k / 3 - 1) * (ptrdiff_t)canvas->chunkCols +
+								   (k % 3 - 1);
+				Chunk *neighbor = chunk + offset;
+				ExtendDirtyRect(&neighbor->rect, spill.y0, spill.x0, spill.y1,
+								spill.x1);
+				ExtendDirtyRect(&neighbor->next, spill.y0, spill.x0, spill.y1,
+								spill.x1);
+				chunk->spill[k] = DIRTY_RECT_EMPTY;
+				for (int t = 0; t < PARTICLE_TYPE_COUNT; ++t) {
+					neighbor->counts[t] += chunk->spillCounts[k][t];
+					chunk->spillCounts[k][t] = 0;
+				}
+			}
+		}
+	}
+
+	for (size_t w = 0; w < ThreadPoolWorkers(canvas->pool); ++w) {
+		CanvasWorker *worker = &canvas->workers[w];
+		for (size_t i = 0; i < worker->movedLen; ++i) {
+			canvas->cells[worker->moved[i]] &= ~PARTICLE_UPDATED;
+		}
+		worker->movedLen = 0;
+	}
+
+	// Every move marks its surroundings for the next tick, so chunks with
+	// nothing to do next tick didn't change either
+	for (size_t i = 0; i < chunkCount; ++i) {
+		if (!IsDirtyRectEmpty(canvas->chunks[i].next)) {
+			++canvas->chunks[i].version;
+		}
+	}
+}
+
+// Bits [c, c + len) of a visited row
+static inline uint64_t VisitedSpan(size_t c, size_t len) {
+	return (len >= 64 ? ~(uint64_t)0 : ((uint64_t)1 << len) - 1) << c;
+}
+
+// Make room for `len` rectangles, doubling the capacity
+static void ReservePrefabRecs(Rectangle **recs, Color **colors, size_t *cap,
+							  size_t len) {
+	if (len <= *cap) return;
+	size_t newCap = *cap ? *cap : 64;
+	while (newCap < len) newCap *= 2;
+	*recs = realloc(*recs, sizeof(Rectangle) * newCap);
+	*colors = realloc(*colors, sizeof(Color) * newCap);
+	*cap = newCap;
+}
+
+// Merge the visible cells of chunk (cy, cx) into rectangles of one type.
+// `visited` holds one bit per tile cell, bit c of row r is cell (r, c)
+// relative to the tile corner.
+static void BuildPrefabTile(const Canvas *canvas, PrefabTile *tile,
+							uint64_t *visited, size_t cy, size_t cx) {
+	_Static_assert(CHUNK_SIZE <= 64, "a tile row must fit a visited word");
+	size_t i, j, r, c, width, height;
+	bool flagw, flagh;
+	ParticleType type;
+	ParticleInfo info;
+	Particle *row;
+
+	size_t y0 = cy * CHUNK_SIZE, x0 = cx * CHUNK_SIZE;
+	size_t y1 = y0 + CHUNK_SIZE < canvas->height ? y0 + CHUNK_SIZE
+												 : canvas->height;
+	size_t x1 = x0 + CHUNK_SIZE < canvas->width ? x0 + CHUNK_SIZE
+												: canvas->width;
+	memset(visited, 0, sizeof(uint64_t) * CHUNK_SIZE);
+
+	tile->len = 0;
+	for (i = 0; i < y1 - y0; ++i) {
+		row = CanvasCell(canvas, y0 + i, x0);
+		for (j = 0; j < x1 - x0; ++j) {
+			info = GetParticleInfo(row[j]);
+			if (visited[i] >> j & 1 || info.flag & PARTICLE_INVISIBLE) continue;
+
+			type = GetParticleType(row[j]);
+			width = 1, height = 1, flagw = false, flagh = false;
+
+			while (true) {
+				if (y0 + i + height >= y1) flagh = true;
+				if (x0 + j + width >= x1) flagw = true;
+				if (flagh && flagw) break;
+
+				if (!flagw) {
+					for (r = i, c = j + width; r < i + height; ++r) {
+						if (visited[r] >> c & 1 ||
+							GetParticleType(
+								*CanvasCell(canvas, y0 + r, x0 + c)) != type) {
+							flagw = true;
+							break;
+						}
+					}
+					if (!flagw) ++width;
+				}
+
+				if (!flagh) {
+					Particle *next = CanvasCell(canvas, y0 + i + height, x0);
+					if (visited[i + height] & VisitedSpan(j, width)) {
+						flagh = true;
+					}
+					for (c = j; !flagh && c < j + width; ++c) {
+						if (GetParticleType(next[c]) != type) flagh = true;
+					}
+					if (!flagh) ++height;
+				}
+			}
+
+			for (r = i; r < i + height; ++r) {
+				visited[r] |= VisitedSpan(j, width);
+			}
+
+			ReservePrefabRecs(&tile->recs, &tile->colors, &tile->cap,
+							  tile->len + 1);
+			int size = canvas->particleSize;
+			tile->recs[tile->len] =
+				(Rectangle){(x0 + j) * size, (y0 + i) * size, width * size,
+							height * size};
+			tile->colors[tile->len++] = info.color;
+		}
+	}
+}
+
+// The prefab is kept per chunk, only chunks whose version moved since their
+// tile was built are merged again. The tiles are then concatenated into
+// `recs`, so large static areas cost nothing while a small part of the
+// canvas is moving.
+void UpdateCanvasPrefab(Canvas *canvas, CanvasPrefab *prefab) {
+	size_t chunkCount = canvas->chunkCols * canvas->chunkRows;
+	if (prefab->tiles == NULL) {
+		prefab->tiles = calloc(chunkCount, sizeof(PrefabTile));
+		prefab->tileCount = chunkCount;
+	}
+
+	prefab->changed = false;
+	size_t len = 0;
+	for (size_t i = 0; i < chunkCount; ++i) {
+		PrefabTile *tile = &prefab->tiles[i];
+		unsigned version = canvas->chunks[i].version;
+		if (!tile->valid || tile->version != version) {
+			BuildPrefabTile(canvas, tile, prefab->visited,
+							i / canvas->chunkCols, i % canvas->chunkCols);
+			tile->version = version, tile->valid = true;
+			prefab->changed = true;
+		}
+		len += tile->len;
+	}
+	if (!prefab->changed) return;
+
+	ReservePrefabRecs(&prefab->recs, &prefab->colors, &prefab->cap, len);
+	prefab->len = 0;
+	for (size_t i = 0; i < chunkCount; ++i) {
+		PrefabTile *tile = &prefab->tiles[i];
+		memcpy(prefab->recs + prefab->len, tile->recs,
+			   sizeof(Rectangle) * tile->len);
+		memcpy(prefab->colors + prefab->len, tile->colors,
+			   sizeof(Color) * tile->len);
+		prefab->len += tile->len;
+	}
+}
+
+typedef struct {
+	const Canvas *canvas;
+	CanvasPixels *pixels;
+} PixelsUpdate;
+
+static void UpdatePixelsTask(void *ctx, size_t index, size_t worker) {
+	(void)worker;
+	const Canvas *canvas = ((PixelsUpdate *)ctx)->canvas;
+	CanvasPixels *pixels = ((PixelsUpdate *)ctx)->pixels;
+	const Chunk *chunks = canvas->chunks + index * canvas->chunkCols;
+	unsigned *versions = pixels->versions + index * canvas->chunkCols;
+	size_t r0 = index * CHUNK_SIZE, r1 = r0 + CHUNK_SIZE;
+	if (r1 > canvas->height) r1 = canvas->height;
+
+	// Runs of changed chunks are colored a row at a time
+	for (size_t i = 0; i < canvas->chunkCols;) {
+		size_t end = i;
+		while (end < canvas->chunkCols &&
+			   (!pixels->valid || versions[end] != chunks[end].version)) {
+			versions[end] = chunks[end].version;
+			++end;
+		}
+		if (end == i) {
+			++i;
+			continue;
+		}
+		size_t c0 = i * CHUNK_SIZE, c1 = end * CHUNK_SIZE;
+		if (c1 > canvas->width) c1 = canvas->width;
+		for (size_t r = r0; r < r1; ++r) {
+			const Particle *row = CanvasCell(canvas, r, 0);
+			Color *out = pixels->pixels + r * canvas->width;
+			for (size_t c = c0; c < c1; ++c) {
+				out[c] = GetParticleInfo(row[c]).color;
+			}
+		}
+		i = end;
+	}
+}
+
+// Color the cells of every chunk whose version moved since `pixels` last
+// saw it, one band of chunk rows per task
+void UpdateCanvasPixels(Canvas *canvas, CanvasPixels *pixels) {
+	size_t chunkCount = canvas->chunkCols * canvas->chunkRows;
+	if (pixels->pixels == NULL) {
+		pixels->width = canvas->width, pixels->height = canvas->height;
+		pixels->pixels = malloc(sizeof(Color) * canvas->width * canvas->height);
+		pixels->versions = malloc(sizeof(unsigned) * chunkCount);
+	}
+	pixels->changed = !pixels->valid;
+	for (size_t i = 0; i < chunkCount && !pixels->changed; ++i) {
+		pixels->changed = pixels->versions[i] != canvas->chunks[i].version;
+	}
+	if (!pixels->changed) return;
+
+	PixelsUpdate update = {canvas, pixels};
+	ThreadPoolRun(canvas->pool, UpdatePixelsTask, &update, canvas->chunkRows);
+	pixels->valid = true;
+}
+
+bool InitCanvas(Canvas *canvas, size_t width, size_t height,
+				int particleSize, size_t threads) {
+	_Static_assert(CANVAS_ALIGNMENT % sizeof(Particle) == 0,
+				   "canvas alignment must be a multiple of the cell size");
+	size_t rowBytes = (width + 2 * CANVAS_PADDING) * sizeof(Particle);
+	rowBytes = (rowBytes + CANVAS_ALIGNMENT - 1) & ~(CANVAS_ALIGNMENT - 1);
+	size_t rows = height + 2 * CANVAS_PADDING;
+
+	canvas->width = width, canvas->height = height;
+	canvas->particleSize = particleSize;
+	canvas->stride = rowBytes / sizeof(Particle);
+	canvas->cells = aligned_alloc(CANVAS_ALIGNMENT, rowBytes * rows);
+
+	canvas->chunkCols = (width + CHUNK_SIZE - 1) / CHUNK_SIZE;
+	canvas->chunkRows = (height + CHUNK_SIZE - 1) / CHUNK_SIZE;
+	size_t chunkCount = canvas->chunkCols * canvas->chunkRows;
+	canvas->chunks = malloc(sizeof(Chunk) * chunkCount);
+	canvas->phaseChunks = malloc(sizeof(size_t) * chunkCount);
+	canvas->pool = MakeThreadPool(threads);
+	canvas->workers =
+		calloc(ThreadPoolWorkers(canvas->pool), sizeof(CanvasWorker));
+	if (canvas->cells == NULL || canvas->chunks == NULL ||
+		canvas->phaseChunks == NULL || canvas->workers == NULL) {
+		free(canvas->workers);
+		FreeThreadPool(canvas->pool);
+		free(canvas->phaseChunks);
+		free(canvas->chunks);
+		free(canvas->cells);
+		*canvas = (Canvas){0};
+		return false;
+	}
+	for (size_t i = 0; i < chunkCount; ++i) {
+		canvas->chunks[i].rect = DIRTY_RECT_EMPTY;
+		canvas->chunks[i].next = DIRTY_RECT_EMPTY;
+		canvas->chunks[i].version = 0;
+		for (int k = 0; k < 9; ++k) {
+			canvas->chunks[i].spill[k] = DIRTY_RECT_EMPTY;
+		}
+		memset(canvas->chunks[i].spillCounts, 0,
+			   sizeof(canvas->chunks[i].spillCounts));
+	}
+
+	// Ghost border, the visible border and air inside it
+	memset(canvas->cells, PARTICLE_BORDER, rowBytes * rows);
+	for (size_t r = 1; r + 1 < height; ++r) {
+		memset(CanvasCell(canvas, r, 1), PARTICLE_AIR, width - 2);
+	}
+	CountParticles(canvas);
+	return true;
+}
+
+void FreeCanvas(Canvas *canvas) {
+	for (size_t i = 0; i < ThreadPoolWorkers(canvas->pool); ++i) {
+		free(canvas->workers[i].moved);
+	}
+	free(canvas->workers);
+	FreeThreadPool(canvas->pool);
+	free(canvas->phaseChunks);
+	free(canvas->chunks);
+	free(canvas->cells);
+	*canvas = (Canvas){0};
+}
+
+bool InitCanvasCopy(Canvas *copy, const Canvas *canvas) {
+	if (!InitCanvas(copy, canvas->width, canvas->height, canvas->particleSize,
+					1)) {
+		return false;
+	}
+	memcpy(copy->cells, canvas->cells,
+		   sizeof(Particle) * canvas->stride *
+			   (canvas->height + 2 * CANVAS_PADDING));
+	for (size_t i = 0; i < canvas->chunkCols * canvas->chunkRows; ++i) {
+		copy->chunks[i].version = canvas->chunks[i].version;
+		memcpy(copy->chunks[i].counts, canvas->chunks[i].counts,
+			   sizeof(canvas->chunks[i].counts));
+	}
+	memcpy(copy->counts, canvas->counts, sizeof(canvas->counts));
+	return true;
+}
+
+// Every change to a chunk's cells bumps its version, so chunks at the same
+// version as in `copy` are up to date already
+void SyncCanvasCopy(Canvas *copy, const Canvas *canvas) {
+	for (size_t i = 0; i < canvas->chunkCols * canvas->chunkRows; ++i) {
+		unsigned version = canvas->chunks[i].version;
+		if (copy->chunks[i].version == version) continue;
+
+		size_t y0, x0, y1, x1;
+		GetChunkBounds(canvas, i, &y0, &x0, &y1, &x1);
+		for (size_t r = y0; r < y1; ++r) {
+			memcpy(CanvasCell(copy, r, x0), CanvasCell(canvas, r, x0),
+				   sizeof(Particle) * (x1 - x0));
+		}
+		memcpy(copy->chunks[i].counts, canvas->chunks[i].counts,
+			   sizeof(canvas->chunks[i].counts));
+		copy->chunks[i].version = version;
+	}
+	memcpy(copy->counts, canvas->counts, sizeof(canvas->counts));
+}
+
+// FNV-1a over the particle type of every visible cell
+uint64_t CanvasChecksum(const Canvas *canvas) {
+	uint64_t hash = 0xcbf29ce484222325ull;
+	for (size_t r = 0; r < canvas->height; ++r) {
+		const Particle *row = CanvasCell(canvas, r, 0);
+		for (size_t c = 0; c < canvas->width; ++c) {
+			hash = (hash ^ GetParticleType(row[c])) * 0x100000001b3ull;
+		}
+	}
+	return hash;
+}
+
+void FreeCanvasPrefab(CanvasPrefab *prefab) {
+	for (size_t i = 0; i < prefab->tileCount; ++i) {
+		free(prefab->tiles[i].recs);
+		free(prefab->tiles[i].colors);
+	}
+	free(prefab->tiles);
+	free(prefab->recs);
+	free(prefab->colors);
+	*prefab = (CanvasPrefab){0};
+}
+
+void FreeCanvasPixels(CanvasPixels *pixels) {
+	free(pixels->pixels);
+	free(pixels->versions);
+	*pixels = (CanvasPixels){0};
+}
@@ -0,0 +1,200 @@
+#define _POSIX_C_SOURCE 200809L
+#include "op_log.h"
+
+#include <string.h>
+
+#include "brush.h"
+#include "canvas.h"
+
+#define OP_LOG_MAGIC   "SOPL"
+#define OP_LOG_VERSION 1
+#define OP_LOG_END     0   // record kind of the end record
+
+static void WriteVarint(FILE *file, uint64_t value) {
+	while (value >= 0x80) {
+		putc((int)(value & 0x7f) | 0x80, file);
+		value >>= 7;
+	}
+	putc((int)value, file);
+}
+
+static void WriteSigned(FILE *file, int64_t value) {
+	WriteVarint(file, ((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+}
+
+static bool ReadVarint(FILE *file, uint64_t *value) {
+	*value = 0;
+	for (int shift = 0; shift < 64; shift += 7) {
+		int byte = getc(file);
+		if (byte == EOF) return false;
+		*value |= (uint64_t)(byte & 0x7f) << shift;
+		if (!(byte & 0x80)) return true;
+	}
+	return false;
+}
+
+static bool ReadSigned(FILE *file, int64_t *value) {
+	uint64_t zigzag;
+	if (!ReadVarint(file, &zigzag)) return false;
+	*value = (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+	return true;
+}
+
+bool OpenOpLog(OpLogWriter *log, const char *path, const OpLogHeader *header) {
+	*log = (OpLogWriter){fopen(path, "wb"), 0, 0, 0};
+	if (log->file == NULL) return false;
+
+	fwrite(OP_LOG_MAGIC, 1, 4, log->file);
+	putc(OP_LOG_VERSION, log->file);
+	WriteVarint(log->file, header->width);
+	WriteVarint(log->file, header->height);
+	WriteVarint(log->file, header->scale);
+	WriteVarint(log->file, header->seed);
+	size_t len = strnlen(header->scene, OP_LOG_MAX_SCENE - 1);
+	WriteVarint(log->file, len);
+	fwrite(header->scene, 1, len, log->file);
+	return true;
+}
+
+void OpLogWrite(OpLogWriter *log, size_t tick, const Operation *op) {
+	putc(op->type + 1, log->file);
+	WriteVarint(log->file, tick - log->tick);
+	log->tick = tick;
+
+	switch (op->type) {
+		case OP_BRUSH_SWITCH:
+		case OP_BRUSH_DRAW: {
+			// While dragging `from` is the previous position, a zero delta
+			const BrushOp *brush = &op->brush;
+			WriteSigned(log->file, (int64_t)brush->x - log->x);
+			WriteSigned(log->file, (int64_t)brush->y - log->y);
+			WriteSigned(log->file, (int64_t)brush->fromX - log->x);
+			WriteSigned(log->file, (int64_t)brush->fromY - log->y);
+			WriteVarint(log->file, brush->size);
+			WriteVarint(log->file, brush->type);
+			log->x = brush->x, log->y = brush->y;
+			break;
+		}
+		case OP_CANVAS_SAVE:
+			break;
+	}
+}
+
+void CloseOpLog(OpLogWriter *log, size_t ticks, uint64_t checksum) {
+	putc(OP_LOG_END, log->file);
+	WriteVarint(log->file, ticks - log->tick);
+	for (int i = 0; i < 8; ++i) {
+		putc((int)(checksum >> (8 * i)) & 0xff, log->file);
+	}
+	fclose(log->file);
+	log->file = NULL;
+}
+
+static bool ReadHeader(FILE *file, OpLogHeader *header) {
+	char magic[4];
+	if (fread(magic, 1, 4, file) != 4 || memcmp(magic, OP_LOG_MAGIC, 4) != 0 ||
+		getc(file) != OP_LOG_VERSION) {
+		return false;
+	}
+
+	uint64_t fields[5];
+	for (int i = 0; i < 5; ++i) {
+		if (!ReadVarint(file, &fields[i])) return false;
+	}
+	if (fields[4] >= OP_LOG_MAX_SCENE) return false;
+	*header = (OpLogHeader){
+		.width = fields[0],
+		.height = fields[1],
+		.scale = fields[2],
+		.seed = fields[3],
+	};
+	return fread(header->scene, 1, fields[4], file) == fields[4];
+}
+
+// False at the end record or where the log is cut short
+static bool ReadRecord(FILE *file, OpLog *log, OpLogRecord *record, int *x,
+					   int *y) {
+	int kind = getc(file);
+	uint64_t delta;
+	if (kind == EOF || !ReadVarint(file, &delta)) return false;
+	record->tick = (log->len ? log->records[log->len - 1].tick : 0) + delta;
+
+	if (kind == OP_LOG_END) {
+		uint64_t checksum = 0;
+		for (int i = 0; i < 8; ++i) {
+			int byte = getc(file);
+			if (byte == EOF) return false;
+			checksum |= (uint64_t)byte << (8 * i);
+		}
+		log->ticks = record->tick;
+		log->checksum = checksum;
+		log->complete = true;
+		return false;
+	}
+
+	record->op.type = kind - 1;
+	switch (record->op.type) {
+		case OP_BRUSH_SWITCH:
+		case OP_BRUSH_DRAW: {
+			int64_t dx, dy, fromX, fromY;
+			uint64_t size, type;
+			if (!ReadSigned(file, &dx) || !ReadSigned(file, &dy) ||
+				!ReadSigned(file, &fromX) || !ReadSigned(file, &fromY) ||
+				!ReadVarint(file, &size) || !ReadVarint(file, &type)) {
+				return false;
+			}
+			if (size < 1 || size > MAX_BRUSH_SIZE ||
+				type >= PARTICLE_TYPE_COUNT) {
+				return false;
+			}
+			record->op.brush = (BrushOp){
+				.x = *x + dx,
+				.y = *y + dy,
+				.fromX = *x + fromX,
+				.fromY = *y + fromY,
+				.size = size,
+				.type = type,
+			};
+			*x = record->op.brush.x, *y = record->op.brush.y;
+			return true;
+		}
+		case OP_CANVAS_SAVE:
+			return true;
+	}
+	return false;  // unknown operation, written by a newer build
+}
+
+bool LoadOpLog(OpLog *log, const char *path) {
+	*log = (OpLog){0};
+	FILE *file = fopen(path, "rb");
+	if (file == NULL) return false;
+	if (!ReadHeader(file, &log->header)) {
+		fclose(file);
+		return false;
+	}
+
+	size_t cap = 0;
+	int x = 0, y = 0;
+	OpLogRecord record;
+	while (ReadRecord(file, log, &record, &x, &y)) {
+		if (log->len == cap) {
+			cap = cap ? cap * 2 : 256;
+			log->records = realloc(log->records, sizeof(OpLogRecord) * cap);
+		}
+		log->records[log->len++] = record;
+	}
+	// Records end early at the end of the file only, anything else is an
+	// invalid or unknown operation
+	bool valid = log->complete || feof(file);
+	if (!log->complete) {
+		log->ticks = log->len ? log->records[log->len - 1].tick + 1 : 0;
+	}
+	fclose(file);
+	if (!valid) FreeOpLog(log);
+	return valid;
+}
+
+void FreeOpLog(OpLog *log) {
+	free(log->records);
+	*log = (OpLog){0};
+}
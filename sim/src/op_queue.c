@@ -1,51 +1,98 @@
+#define _POSIX_C_SOURCE 200112L
 #include "op_queue.h"
 
-#include <stdio.h>
 #include <stdlib.h>
-#include <string.h>
-
-OpQueue *MakeEmptyOpQueue() { return calloc(1, sizeof(OpQueue)); }
-
-void OpQueuePush(OpQueue *queue, Operation op) {
-	if (queue->len == 0) {
-		queue->front = calloc(1, sizeof(QueueNode));
-		queue->front->op = op;
-		queue->back = queue->front;
-	} else {
-		QueueNode *p = calloc(1, sizeof(QueueNode));
-		p->prev = queue->back;
-		queue->back->next = p;
-		queue->back = p;
-	}
-	++queue->len;
+
+#if !defined(PLATFORM_WEB)
+	#include <sched.h>
+#endif
+
+#define OP_QUEUE_MASK (OP_QUEUE_CAPACITY - 1)
+
+_Static_assert((OP_QUEUE_CAPACITY & OP_QUEUE_MASK) == 0,
+			   "op queue capacity must be a power of two");
+
+OpQueue *MakeEmptyOpQueue(OpOverflowPolicy overflow) {
+	OpQueue *queue = aligned_alloc(_Alignof(OpQueue), sizeof(OpQueue));
+	atomic_init(&queue->head, 0);
+	atomic_init(&queue->tail, 0);
+	queue->hasPending = false;
+	queue->dropped = 0;
+	queue->overflow = overflow;
+	return queue;
 }
 
-void OpQueuePop(OpQueue *queue) {
-	if (queue->len == 0) return;
+void FreeOpQueue(OpQueue *queue) { free(queue); }
+
+// The slot is written before the release store of `tail` publishes it
+static bool TryPush(OpQueue *queue, Operation op) {
+	size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+	size_t head = atomic_load_explicit(&queue->head, memory_order_acquire);
+	if (tail - head == OP_QUEUE_CAPACITY) return false;
 
-	QueueNode *tmp = queue->front;
+	queue->ops[tail & OP_QUEUE_MASK] = op;
+	atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+	return true;
+}
 
-	if (queue->len == 1) {
-		queue->front = NULL;
-		queue->back = NULL;
-	} else {
-		queue->front = queue->front->next;
-		queue->front->prev = NULL;
+bool OpQueueFlush(OpQueue *queue) {
+	if (queue->hasPending && TryPush(queue, queue->pending)) {
+		queue->hasPending = false;
 	}
+	return !queue->hasPending;
+}
 
-	if (tmp->op.data != NULL) free(tmp->op.data);
-	free(tmp);
-	--queue->len;
+// A brush op only stands in for one drawn with the same size and material,
+// or the earlier part of the drag would be painted with the newer brush
+static bool CanCoalesce(const Operation *pending, const Operation *op) {
+	if (pending->type != op->type) return false;
+	if (op->type != OP_BRUSH_SWITCH && op->type != OP_BRUSH_DRAW) return true;
+	return pending->brush.size == op->brush.size &&
+		   pending->brush.type == op->brush.type;
 }
 
-const char *BumpQueue(OpQueue *queue) {
-	if (queue->len == 0) return "";
+bool OpQueuePush(OpQueue *queue, Operation op) {
+	// A held back operation goes first to keep the order
+	if (OpQueueFlush(queue) && TryPush(queue, op)) return true;
 
-	char *nodeStrs[queue->len];
-	QueueNode *node = queue->front;
-	for (size_t i = 0; i < queue->len; ++i) {
-		sprintf(nodeStrs[i], "%d", node->op.type);
-		node = node->next;
+	switch (queue->overflow) {
+		case OP_OVERFLOW_BLOCK:
+			while (!OpQueueFlush(queue) || !TryPush(queue, op)) {
+#if !defined(PLATFORM_WEB)
+				sched_yield();
+#endif
+			}
+			return true;
+		case OP_OVERFLOW_COALESCE:
+			if (!queue->hasPending || CanCoalesce(&queue->pending, &op)) {
+				if (queue->hasPending) ++queue->dropped;
+				// The merged draw still sweeps from where the dropped one began
+				if (queue->hasPending && op.type == OP_BRUSH_DRAW) {
+					op.brush.fromX = queue->pending.brush.fromX;
+					op.brush.fromY = queue->pending.brush.fromY;
+				}
+				queue->pending = op, queue->hasPending = true;
+				return true;
+			}
+			break;
+		case OP_OVERFLOW_DROP:
+			break;
 	}
-	return strsep(nodeStrs, ",");
+	++queue->dropped;
+	return false;
+}
+
+const Operation *OpQueueFront(OpQueue *queue) {
+	size_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+	size_t tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+	if (head == tail) return NULL;
+	return &queue->ops[head & OP_QUEUE_MASK];
+}
+
+// The release store hands the slot back to the producer
+void OpQueuePop(OpQueue *queue) {
+	size_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+	size_t tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+	if (head == tail) return;
+	atomic_store_explicit(&queue->head, head + 1, memory_order_release);
 }
@@ -0,0 +1,91 @@
+#include <assert.h>
+#include <stdio.h>
+
+#include "op_queue.h"
+
+// Checks of the op queue's overflow policies, see `make test`
+
+static Operation Draw(int fromX, int x) {
+	return (Operation){
+		.type = OP_BRUSH_DRAW,
+		.brush = {.x = x, .y = 0, .fromX = fromX, .fromY = 0, .size = 1},
+	};
+}
+
+static void Fill(OpQueue *queue) {
+	for (int i = 0; i < OP_QUEUE_CAPACITY; ++i) {
+		assert(OpQueuePush(queue, Draw(i, i + 1)));
+	}
+	assert(OpQueueLen(queue) == OP_QUEUE_CAPACITY);
+}
+
+static void Drain(OpQueue *queue) {
+	while (OpQueueFront(queue) != NULL) OpQueuePop(queue);
+}
+
+// The drag ends while the queue is full: its tail is held back and has to
+// get through on a flush alone, with no push after it
+static void TestReleaseWhileFull() {
+	OpQueue *queue = MakeEmptyOpQueue(OP_OVERFLOW_COALESCE);
+	Fill(queue);
+	assert(OpQueuePush(queue, Draw(256, 300)));
+	assert(OpQueuePush(queue, Draw(300, 400)));
+	assert(queue->hasPending && queue->dropped == 1);
+
+	assert(!OpQueueFlush(queue));
+	Drain(queue);
+	assert(OpQueueFlush(queue));
+	const Operation *op = OpQueueFront(queue);
+	assert(op != NULL && op->type == OP_BRUSH_DRAW);
+	assert(op->brush.fromX == 256 && op->brush.x == 400);
+	OpQueuePop(queue);
+	assert(OpQueueFront(queue) == NULL);
+	FreeOpQueue(queue);
+}
+
+// A held back op goes out before a newer one of another type
+static void TestCoalesceKeepsOrder() {
+	OpQueue *queue = MakeEmptyOpQueue(OP_OVERFLOW_COALESCE);
+	Fill(queue);
+	assert(OpQueuePush(queue, Draw(256, 300)));
+	assert(!OpQueuePush(queue, (Operation){.type = OP_CANVAS_SAVE}));
+	Drain(queue);
+	assert(OpQueuePush(queue, (Operation){.type = OP_CANVAS_SAVE}));
+	assert(OpQueueFront(queue)->type == OP_BRUSH_DRAW);
+	OpQueuePop(queue);
+	assert(OpQueueFront(queue)->type == OP_CANVAS_SAVE);
+	FreeOpQueue(queue);
+}
+
+// A draw with another material or size doesn't replace the held back one
+static void TestCoalesceKeepsBrush() {
+	OpQueue *queue = MakeEmptyOpQueue(OP_OVERFLOW_COALESCE);
+	Fill(queue);
+	assert(OpQueuePush(queue, Draw(256, 300)));
+	Operation other = Draw(300, 400);
+	other.brush.type = 2;
+	assert(!OpQueuePush(queue, other));
+	other = Draw(300, 400);
+	other.brush.size = 8;
+	assert(!OpQueuePush(queue, other));
+	assert(queue->hasPending && queue->dropped == 2);
+	assert(queue->pending.brush.fromX == 256 && queue->pending.brush.x == 300);
+	FreeOpQueue(queue);
+}
+
+static void TestDrop() {
+	OpQueue *queue = MakeEmptyOpQueue(OP_OVERFLOW_DROP);
+	Fill(queue);
+	assert(!OpQueuePush(queue, Draw(256, 300)));
+	assert(!queue->hasPending && queue->dropped == 1);
+	FreeOpQueue(queue);
+}
+
+int main() {
+	TestReleaseWhileFull();
+	TestCoalesceKeepsOrder();
+	TestCoalesceKeepsBrush();
+	TestDrop();
+	printf("op queue: ok\n");
+	return 0;
+}
@@ -0,0 +1,82 @@
+#include "profile.h"
+
+#include <stdio.h>
+
+#include "trace.h"
+#include "util.h"
+
+#define PROFILE_MASK (PROFILE_SAMPLES - 1)
+
+_Static_assert((PROFILE_SAMPLES & PROFILE_MASK) == 0,
+			   "profile samples must be a power of two");
+
+static PhaseSamples phases[PHASE_COUNT];
+
+static const char *phaseNames[PHASE_COUNT] = {
+	[PHASE_INPUT] = "Input",
+	[PHASE_DRAW] = "Draw",
+	[PHASE_PRESENT] = "Present",
+	[PHASE_OPERATIONS] = "HandleOperation",
+	[PHASE_PARTICLES] = "UpdateParticles",
+	[PHASE_HAND_OFF] = "HandOffTick",
+	[PHASE_RENDER_DATA] = "BuildRenderFrame",
+};
+
+const char *GetPhaseName(ProfilePhase phase) { return phaseNames[phase]; }
+
+double RecordPhase(ProfilePhase phase, double start) {
+	double now = GetMonotonicTime();
+	double ns = (now - start) * 1e9;
+	uint_least32_t sample = ns < UINT32_MAX ? (uint_least32_t)ns : UINT32_MAX;
+
+	// Only this thread writes the phase, readers may see a sample late
+	PhaseSamples *samples = &phases[phase];
+	size_t len = atomic_load_explicit(&samples->len, memory_order_relaxed);
+	atomic_store_explicit(&samples->samples[len & PROFILE_MASK], sample,
+						  memory_order_relaxed);
+	atomic_store_explicit(&samples->len, len + 1, memory_order_release);
+	TraceSpan(phaseNames[phase], start, now);
+	return now;
+}
+
+static int CompareSample(const void *a, const void *b) {
+	uint_least32_t x = *(const uint_least32_t *)a;
+	uint_least32_t y = *(const uint_least32_t *)b;
+	return (x > y) - (x < y);
+}
+
+PhaseStats GetPhaseStats(ProfilePhase phase) {
+	PhaseSamples *samples = &phases[phase];
+	size_t len = atomic_load_explicit(&samples->len, memory_order_acquire);
+	if (len > PROFILE_SAMPLES) len = PROFILE_SAMPLES;
+	if (len == 0) return (PhaseStats){0};
+
+	uint_least32_t sorted[PROFILE_SAMPLES];
+	for (size_t i = 0; i < len; ++i) {
+		sorted[i] = atomic_load_explicit(&samples->samples[i],
+										 memory_order_relaxed);
+	}
+	qsort(sorted, len, sizeof(sorted[0]), CompareSample);
+	return (PhaseStats){
+		.len = len,
+		.min = sorted[0] / 1e9,
+		.median = sorted[len / 2] / 1e9,
+		.p99 = sorted[(size_t)(0.99 * (len - 1) + 0.5)] / 1e9,
+		.max = sorted[len - 1] / 1e9,
+	};
+}
+
+bool WritePhaseStatsCsv(const char *path) {
+	FILE *file = fopen(path, "w");
+	if (file == NULL) return false;
+
+	fprintf(file, "phase,samples,min_ms,median_ms,p99_ms,max_ms\n");
+	for (int i = 0; i < PHASE_COUNT; ++i) {
+		PhaseStats stats = GetPhaseStats(i);
+		if (stats.len == 0) continue;
+		fprintf(file, "%s,%zu,%.4f,%.4f,%.4f,%.4f\n", GetPhaseName(i),
+				stats.len, stats.min * 1e3, stats.median * 1e3,
+				stats.p99 * 1e3, stats.max * 1e3);
+	}
+	return fclose(file) == 0;
+}
@@ -0,0 +1,113 @@
+#include "scene.h"
+
+#include <string.h>
+
+typedef void (*SceneBuilder)(Canvas *canvas, unsigned *rng);
+
+// Same sequence on every platform, unlike rand()
+static unsigned NextRandom(unsigned *rng) {
+	*rng = *rng * 1103515245u + 12345u;
+	return (*rng >> 16) & 0x7fff;
+}
+
+// Fill the rows [r0, r1) and columns [c0, c1) inside the canvas border with
+// `type`, each cell with probability `density` percent
+static void FillRect(Canvas *canvas, unsigned *rng, int r0, int c0, int r1,
+					 int c1, ParticleType type, unsigned density) {
+	if (r0 < 1) r0 = 1;
+	if (c0 < 1) c0 = 1;
+	if (r1 > (int)canvas->height - 1) r1 = canvas->height - 1;
+	if (c1 > (int)canvas->width - 1) c1 = canvas->width - 1;
+
+	for (int r = r0; r < r1; ++r) {
+		for (int c = c0; c < c1; ++c) {
+			if (density < 100 && NextRandom(rng) % 100 >= density) continue;
+			*CanvasCell(canvas, r, c) = GetParticleByType(type);
+		}
+	}
+}
+
+static void BuildEmpty(Canvas *canvas, unsigned *rng) {
+	(void)canvas, (void)rng;
+}
+
+// A tall column of sand collapsing into a pile
+static void BuildSandPile(Canvas *canvas, unsigned *rng) {
+	int w = canvas->width, h = canvas->height;
+	FillRect(canvas, rng, h / 10, w / 3, h, w - w / 3, PARTICLE_SAND, 95);
+}
+
+static void BuildWaterTank(Canvas *canvas, unsigned *rng) {
+	int w = canvas->width, h = canvas->height;
+	FillRect(canvas, rng, h / 10, 0, h, w, PARTICLE_WATER, 98);
+}
+
+// A slab of sand above a pool of water
+static void BuildSandIntoWater(Canvas *canvas, unsigned *rng) {
+	int w = canvas->width, h = canvas->height;
+	FillRect(canvas, rng, h / 2, 0, h, w, PARTICLE_WATER, 100);
+	FillRect(canvas, rng, h / 10, w / 4, h / 3, w - w / 4, PARTICLE_SAND, 90);
+}
+
+// Stone terrain with a few pockets of sand and water, mostly at rest
+static void BuildStoneWorld(Canvas *canvas, unsigned *rng) {
+	int w = canvas->width, h = canvas->height;
+	int ground = h / 5;
+	for (int c = 1; c < w - 1; ++c) {
+		ground += (int)(NextRandom(rng) % 3) - 1;
+		if (ground < h / 10) ground = h / 10;
+		if (ground > h / 3) ground = h / 3;
+		FillRect(canvas, rng, ground, c, h, c + 1, PARTICLE_STONE, 100);
+	}
+	for (int i = 0; i < 8; ++i) {
+		int r = h / 10 + NextRandom(rng) % (h / 10 + 1);
+		int c = NextRandom(rng) % w;
+		ParticleType type = i & 1 ? PARTICLE_WATER : PARTICLE_SAND;
+		FillRect(canvas, rng, r - h / 40, c - w / 40, r, c + w / 40, type, 100);
+	}
+}
+
+// Random sand, water and stone everywhere
+static void BuildNoise(Canvas *canvas, unsigned *rng) {
+	for (size_t r = 1; r + 1 < canvas->height; ++r) {
+		for (size_t c = 1; c + 1 < canvas->width; ++c) {
+			unsigned x = NextRandom(rng) % 10;
+			ParticleType type = x < 3   ? PARTICLE_SAND
+								: x < 5 ? PARTICLE_WATER
+								: x < 6 ? PARTICLE_STONE
+										: PARTICLE_AIR;
+			*CanvasCell(canvas, r, c) = GetParticleByType(type);
+		}
+	}
+}
+
+static const struct {
+	const char *name;
+	SceneBuilder build;
+} scenes[] = {
+	{"empty", BuildEmpty},
+	{"sand-pile", BuildSandPile},
+	{"water-tank", BuildWaterTank},
+	{"sand-into-water", BuildSandIntoWater},
+	{"stone-world", BuildStoneWorld},
+	{"noise", BuildNoise},
+};
+
+bool LoadScene(Canvas *canvas, const char *name, unsigned seed) {
+	for (size_t i = 0; i < GetSceneCount(); ++i) {
+		if (strcmp(scenes[i].name, name) != 0) continue;
+
+		unsigned rng = seed;
+		FillRect(canvas, &rng, 1, 1, canvas->height - 1, canvas->width - 1,
+				 PARTICLE_AIR, 100);
+		scenes[i].build(canvas, &rng);
+		CountParticles(canvas);
+		MarkDirty(canvas, 0, 0, canvas->height - 1, canvas->width - 1);
+		return true;
+	}
+	return false;
+}
+
+size_t GetSceneCount() { return sizeof(scenes) / sizeof(scenes[0]); }
+
+const char *GetSceneName(size_t index) { return scenes[index].name; }
@@ -1,13 +1,29 @@
 #include "sim.h"
 
+#include <limits.h>
 #include <math.h>
+#include <stdatomic.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
+#include "op_log.h"
 #include "op_queue.h"
+#include "profile.h"
 #include "raylib.h"
+#define RAYMATH_STATIC_INLINE
+#include "raymath.h"
+#include "rlgl.h"
+#include "scene.h"
+#include "snapshot.h"
+#include "trace.h"
 #include "util.h"
 
+#if !defined(PLATFORM_WEB)
+	#include <pthread.h>
+#endif
+
 static DebugInfo debugInfo = {
 #ifdef DEBUG
 	.showBrushSize = true,
@@ -16,7 +32,10 @@ static DebugInfo debugInfo = {
 	.showFPS = true,
 	.showBrushInfo = true,
 	.showCanvasPrefabInfo = false,
-	.showOpQueueInfo = true
+	.showOpQueueInfo = true,
+	.showTickInfo = true,
+	.showParticleCounts = true,
+	.showPhaseTimes = true
 #else
 	.showBrushSize = false,
 	.showBrushCursorPosition = false,
@@ -24,177 +43,637 @@ static DebugInfo debugInfo = {
 	.showFPS = false,
 	.showBrushInfo = false,
 	.showCanvasPrefabInfo = false,
-	.showOpQueueInfo = false
+	.showOpQueueInfo = false,
+	.showTickInfo = false,
+	.showParticleCounts = false,
+	.showPhaseTimes = false
 #endif
 };
 
-static const int screenWidth = PARTICLE_SIZE * CANVAS_SIZE;
-static const int screenHeight = PARTICLE_SIZE * CANVAS_SIZE;
 static const float updateFrameTime = 1.0 / (float)TARGET_TICKRATE;
 
-static float accumulatedFrameTime = 0.0;
-static BrushCursor brushCursor = {{0}, SAND_COLOR, 4, 0, NULL, PARTICLE_SAND};
-static Canvas canvas;
+static Options options = {
+	.width = CANVAS_WIDTH,
+	.height = CANVAS_HEIGHT,
+	.scale = PARTICLE_SIZE,
+	.ticks = 1000,
+	.opOverflow = OP_OVERFLOW_COALESCE,
+	.maxTicks = MAX_TICKS_PER_FRAME,
+};
+static TickStats tickStats;
+static BrushCursor brushCursor = {{0}, SAND_COLOR, 4, NULL, PARTICLE_SAND};
+static BrushStampCache cursorStamps;
+static Texture2D cursorTexture;  // stamp of the cursor's current size
 static OpQueue *opQueue;
-static CanvasPrefab canvasPrefab;
+static PrefabMesh prefabMesh;
+static Texture2D canvasTexture;
+static unsigned long textureVersion;
+
+// Owned by the simulation thread once it runs
+static Canvas canvas;
+static BrushStroke brushStroke;
+static OpLogWriter opLog;  // open while recording
+static OpLog replayLog;
+
+// Triple buffered render frames. The render data thread builds renderFrames
+// [backFrame], the render thread draws renderFrames[frontFrame] and the third
+// one is swapped in and out of middleFrame.
+#define FRAME_PUBLISHED 4u  // middleFrame holds a frame not acquired yet
+static unsigned long renderVersion;
+static RenderFrame renderFrames[3];
+static unsigned backFrame = 0, frontFrame = 1;
+static atomic_uint middleFrame = 2;
+
+// Written by whichever thread ticks, read by DrawDebugInfo
+static atomic_size_t droppedTicks;   // skipped for good to bound catch-up
+static atomic_size_t deferredTicks;  // owed, run in the coming frames
+
+#if defined(PLATFORM_WEB)
+static double accumulatedFrameTime = 0.0;
+#else
+static pthread_t simThread;
+static atomic_bool simStop;
+
+// Render frames are built on a thread of their own from renderCanvas, the
+// canvas as of the last tick, while the simulation thread runs the next
+// tick. See HandOffTick.
+static Canvas renderCanvas;
+static size_t renderTick;  // tick renderCanvas holds
+static pthread_t renderDataThread;
+static pthread_mutex_t renderDataMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t renderDataChanged = PTHREAD_COND_INITIALIZER;
+static bool renderDataPending, renderDataStop;
+
+static void *SimulationThread(void *arg);
+static bool StartRenderPipeline();
+static void StopRenderPipeline();
+#endif
+
+static bool CheckOptions(const Options *options);
+static bool LoadReplay();
+static void StopRecording();
+static void ApplyOperation(const Operation *op);
+static void SaveSnapshot();
+static void WriteProfile();
+
+int main(int argc, char **argv) {
+	if (!ParseOptions(argc, argv, &options)) return 1;
+	if (options.replay != NULL && !LoadReplay()) return 1;
+	if (options.trace != NULL && !StartTrace(options.trace)) {
+		fprintf(stderr, "Can't write %s\n", options.trace);
+		return 1;
+	}
+
+	if (options.load != NULL) {
+		if (!LoadCanvasSnapshot(&canvas, options.load, options.scale,
+								options.threads)) {
+			fprintf(stderr, "Can't load snapshot %s\n", options.load);
+			return 1;
+		}
+		options.width = canvas.width, options.height = canvas.height;
+		options.scene = NULL;
+		if (!CheckOptions(&options)) return 1;
+	} else {
+		if (!InitCanvas(&canvas, options.width, options.height, options.scale,
+						options.threads)) {
+			fprintf(stderr, "Can't allocate a %zux%zu canvas\n", options.width,
+					options.height);
+			return 1;
+		}
+		if (options.scene != NULL &&
+			!LoadScene(&canvas, options.scene, options.seed)) {
+			fprintf(stderr, "Unknown scene: %s\n", options.scene);
+			return 1;
+		}
+	}
+	if (options.record != NULL) {
+		OpLogHeader header = {
+			.width = options.width,
+			.height = options.height,
+			.scale = options.scale,
+			.seed = options.seed,
+		};
+		if (options.scene != NULL) {
+			strncpy(header.scene, options.scene, OP_LOG_MAX_SCENE - 1);
+		}
+		if (!OpenOpLog(&opLog, options.record, &header)) {
+			fprintf(stderr, "Can't write %s\n", options.record);
+			return 1;
+		}
+	}
+	if (options.headless) return RunHeadless();
 
-int main(void) {
-	InitWindow(screenWidth, screenHeight, "Sim");
-	InitCanvas(CANVAS_SIZE, CANVAS_SIZE);
-	opQueue = MakeEmptyOpQueue();
+	InitWindow(canvas.width * canvas.particleSize,
+			   canvas.height * canvas.particleSize, "Sim");
+	opQueue = MakeEmptyOpQueue(options.opOverflow);
+	BuildRenderFrame(&canvas, &renderFrames[backFrame], 0);
+	PublishRenderFrame();
+	const RenderFrame *frame = AcquireRenderFrame();
+	if (options.render == RENDER_TEXTURE) {
+		canvasTexture = LoadTextureFromImage((Image){
+			.data = frame->pixels.pixels,
+			.width = frame->pixels.width,
+			.height = frame->pixels.height,
+			.mipmaps = 1,
+			.format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8,
+		});
+		textureVersion = frame->version;
+	}
 	SetExitKey(KEY_ESCAPE);
 	SetConfigFlags(FLAG_VSYNC_HINT);
 
 #if defined(PLATFORM_WEB)
 	emscripten_set_main_loop(MainLoop, 0, 1);
 #else
+	TraceThreadName("Render");
+	if (!StartRenderPipeline()) {
+		fprintf(stderr, "Can't allocate the render canvas\n");
+		CloseWindow();
+		return 1;
+	}
+	pthread_create(&simThread, NULL, SimulationThread, NULL);
 	while (!WindowShouldClose()) {
 		MainLoop();
 	}
+	atomic_store(&simStop, true);
+	pthread_join(simThread, NULL);
+	StopRenderPipeline();
 #endif
+	StopRecording();
+	WriteProfile();
+	StopTrace();
 
+	if (options.render == RENDER_TEXTURE) UnloadTexture(canvasTexture);
+	UnloadPrefabMesh(&prefabMesh);
+	UnloadBrushTexture();
+	FreeOpQueue(opQueue);
 	CloseWindow();
 	return 0;
 }
 
+static bool ParseOverflowPolicy(const char *value, OpOverflowPolicy *policy) {
+	if (strcmp(value, "drop") == 0) {
+		*policy = OP_OVERFLOW_DROP;
+	} else if (strcmp(value, "coalesce") == 0) {
+		*policy = OP_OVERFLOW_COALESCE;
+	} else if (strcmp(value, "block") == 0) {
+#if defined(PLATFORM_WEB)
+		// Input and ticks share one thread, the wait would never end
+		fprintf(stderr, "--op-overflow block needs the simulation thread\n");
+		return false;
+#endif
+		*policy = OP_OVERFLOW_BLOCK;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+bool ParseOptions(int argc, char **argv, Options *options) {
+	for (int i = 1; i < argc; ++i) {
+		const char *arg = argv[i];
+		const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+		if (strcmp(arg, "--headless") == 0) {
+			options->headless = true;
+		} else if (strcmp(arg, "--width") == 0 && value != NULL) {
+			options->width = strtoul(value, NULL, 10), ++i;
+		} else if (strcmp(arg, "--height") == 0 && value != NULL) {
+			options->height = strtoul(value, NULL, 10), ++i;
+		} else if (strcmp(arg, "--scale") == 0 && value != NULL) {
+			options->scale = strtoul(value, NULL, 10), ++i;
+		} else if (strcmp(arg, "--ticks") == 0 && value != NULL) {
+			options->ticks = strtoul(value, NULL, 10), ++i;
+		} else if (strcmp(arg, "--scene") == 0 && value != NULL) {
+			options->scene = value, ++i;
+		} else if (strcmp(arg, "--seed") == 0 && value != NULL) {
+			options->seed = strtoul(value, NULL, 10), ++i;
+		} else if (strcmp(arg, "--threads") == 0 && value != NULL) {
+			options->threads = strtoul(value, NULL, 10), ++i;
+		} else if (strcmp(arg, "--render") == 0 && value != NULL &&
+				   (strcmp(value, "texture") == 0 ||
+					strcmp(value, "prefab") == 0)) {
+			options->render =
+				strcmp(value, "texture") == 0 ? RENDER_TEXTURE : RENDER_PREFAB;
+			++i;
+		} else if (strcmp(arg, "--op-overflow") == 0 && value != NULL &&
+				   ParseOverflowPolicy(value, &options->opOverflow)) {
+			++i;
+		} else if (strcmp(arg, "--record") == 0 && value != NULL) {
+			options->record = value, ++i;
+		} else if (strcmp(arg, "--replay") == 0 && value != NULL) {
+			options->replay = value, options->headless = true, ++i;
+		} else if (strcmp(arg, "--load") == 0 && value != NULL) {
+			options->load = value, ++i;
+		} else if (strcmp(arg, "--save") == 0 && value != NULL) {
+			options->save = value, ++i;
+		} else if (strcmp(arg, "--profile") == 0 && value != NULL) {
+			options->profile = value, ++i;
+		} else if (strcmp(arg, "--trace") == 0 && value != NULL) {
+			options->trace = value, ++i;
+		} else if (strcmp(arg, "--max-ticks") == 0 && value != NULL) {
+			options->maxTicks = strtoul(value, NULL, 10), ++i;
+		} else {
+			fprintf(stderr,
+					"Usage: %s [--width N] [--height N] [--scale N] "
+					"[--headless] [--ticks N] [--scene NAME] [--seed N] "
+					"[--threads N] [--render texture|prefab] "
+					"[--op-overflow drop|coalesce|block] [--record FILE] "
+					"[--replay FILE] [--load FILE] [--save FILE] "
+					"[--profile FILE] [--trace FILE] [--max-ticks N]\n",
+					argv[0]);
+			fprintf(stderr, "Scenes:");
+			for (size_t j = 0; j < GetSceneCount(); ++j) {
+				fprintf(stderr, " %s", GetSceneName(j));
+			}
+			fprintf(stderr, "\n");
+			return false;
+		}
+	}
+	return CheckOptions(options);
+}
+
+// Also run on the options a replayed log brings along
+static bool CheckOptions(const Options *options) {
+	// The visible border alone takes two cells on each axis
+	if (options->width < 3 || options->width > MAX_CANVAS_SIZE ||
+		options->height < 3 || options->height > MAX_CANVAS_SIZE) {
+		fprintf(stderr, "Canvas size must be within 3..%d\n",
+				MAX_CANVAS_SIZE);
+		return false;
+	}
+	// The window is width * scale by height * scale pixels in an int
+	size_t side = options->width > options->height ? options->width
+												   : options->height;
+	if (options->scale < 1 || options->scale > INT_MAX / side) {
+		fprintf(stderr, "Scale must be within 1..%zu\n", INT_MAX / side);
+		return false;
+	}
+	if (options->maxTicks < 1) {
+		fprintf(stderr, "Max ticks must be at least 1\n");
+		return false;
+	}
+	return true;
+}
+
+// Start from the replayed session's canvas
+static bool LoadReplay() {
+	if (!LoadOpLog(&replayLog, options.replay)) {
+		fprintf(stderr, "Can't read op log %s\n", options.replay);
+		return false;
+	}
+	const OpLogHeader *header = &replayLog.header;
+	options.width = header->width;
+	options.height = header->height;
+	options.scale = header->scale;
+	options.seed = header->seed;
+	options.scene = header->scene[0] != '\0' ? header->scene : NULL;
+	options.ticks = replayLog.ticks;
+	return CheckOptions(&options);
+}
+
+static void WriteProfile() {
+	if (options.profile != NULL && !WritePhaseStatsCsv(options.profile)) {
+		fprintf(stderr, "Can't write %s\n", options.profile);
+	}
+}
+
+static void StopRecording() {
+	if (opLog.file != NULL) {
+		CloseOpLog(&opLog, tickStats.ticks, CanvasChecksum(&canvas));
+	}
+}
+
+// Run options.ticks ticks back to back without a window and report the
+// throughput. A replayed op is applied before the tick it was recorded at.
+int RunHeadless() {
+	size_t next = 0;
+	TraceThreadName("Simulation");
+	double start = GetMonotonicTime();
+#if !defined(PLATFORM_WEB)
+	if (!StartRenderPipeline()) {
+		fprintf(stderr, "Can't allocate the render canvas\n");
+		return 1;
+	}
+#endif
+	for (size_t i = 0; i < options.ticks; ++i) {
+		while (next < replayLog.len && replayLog.records[next].tick == i) {
+			ApplyOperation(&replayLog.records[next++].op);
+		}
+		BrushDraw(&brushStroke, &canvas);
+		UpdateGameTick();
+	}
+#if !defined(PLATFORM_WEB)
+	StopRenderPipeline();
+#endif
+	double elapsed = GetMonotonicTime() - start;
+	StopRecording();
+	WriteProfile();
+	StopTrace();
+	if (options.replay == NULL && options.save != NULL) SaveSnapshot();
+
+	size_t ticks = tickStats.ticks ? tickStats.ticks : 1;
+	const char *scene = options.scene != NULL ? options.scene : "empty";
+	if (options.load != NULL) scene = options.load;
+	printf("Canvas: %zux%zu, scene: %s, seed: %u, threads: %zu\n",
+		   canvas.width, canvas.height, scene, options.seed,
+		   ThreadPoolWorkers(canvas.pool));
+	printf("Ticks: %zu in %.3f s, %.1f ticks/s\n", tickStats.ticks, elapsed,
+		   tickStats.ticks / elapsed);
+	printf("UpdateParticles:    %.3f ms/tick\n",
+		   tickStats.particles * 1e3 / ticks);
+	printf("%-19s %.3f ms/tick\n",
+		   options.render == RENDER_TEXTURE ? "UpdateCanvasPixels:"
+											: "UpdateCanvasPrefab:",
+		   tickStats.render * 1e3 / ticks);
+#if !defined(PLATFORM_WEB)
+	printf("HandOffTick:        %.3f ms/tick\n",
+		   tickStats.handOff * 1e3 / ticks);
+#endif
+	if (options.replay == NULL) return 0;
+
+	uint64_t checksum = CanvasChecksum(&canvas);
+	printf("Replayed %zu ops, checksum: %016llx", replayLog.len,
+		   (unsigned long long)checksum);
+	if (!replayLog.complete) {
+		printf(" (log cut short, no recorded checksum)\n");
+		FreeOpLog(&replayLog);
+		return 0;
+	}
+	bool match = checksum == replayLog.checksum;
+	printf(match ? " (matches the recording)\n"
+				 : " (recorded %016llx, MISMATCH)\n",
+		   (unsigned long long)replayLog.checksum);
+	FreeOpLog(&replayLog);
+	return match ? 0 : 1;
+}
+
+// Ticks owed for `*lag` seconds behind real time, at most `limit`. The lag
+// past that is dropped: the simulation slows down rather than owing more
+// ticks than it can catch up on, which would only make it fall further
+// behind.
+static size_t OwedTicks(double *lag, size_t limit) {
+	if (*lag < updateFrameTime) return 0;
+	size_t owed = *lag / updateFrameTime;
+	if (owed <= limit) return owed;
+	atomic_fetch_add(&droppedTicks, owed - limit);
+	*lag -= (owed - limit) * updateFrameTime;
+	return limit;
+}
+
+#if !defined(PLATFORM_WEB)
+// Ticks at TARGET_TICKRATE on its own clock, back to back while behind by
+// up to options.maxTicks ticks
+static void *SimulationThread(void *arg) {
+	(void)arg;
+	TraceThreadName("Simulation");
+	double next = GetMonotonicTime();
+	while (!atomic_load(&simStop)) {
+		HandleOperation();
+		UpdateGameTick();
+		next += updateFrameTime;
+		double now = GetMonotonicTime();
+		double lag = now - next;
+		size_t owed = OwedTicks(&lag, options.maxTicks);
+		next = now - lag;
+		atomic_store(&deferredTicks, owed);
+		TraceCounter("Ticks behind", owed);
+		SleepSeconds(next - now);
+	}
+	return NULL;
+}
+
+// Wait for the last frame to be built, then copy what the tick changed to
+// renderCanvas and have the next frame built from it
+static void HandOffTick() {
+	pthread_mutex_lock(&renderDataMutex);
+	while (renderDataPending) {
+		pthread_cond_wait(&renderDataChanged, &renderDataMutex);
+	}
+	SyncCanvasCopy(&renderCanvas, &canvas);
+	renderTick = tickStats.ticks;
+	renderDataPending = true;
+	pthread_cond_broadcast(&renderDataChanged);
+	pthread_mutex_unlock(&renderDataMutex);
+}
+
+// Builds and publishes a frame per tick handed off. Only this thread touches
+// renderFrames[backFrame] while it runs.
+static void *RenderDataThread(void *arg) {
+	(void)arg;
+	TraceThreadName("Render data");
+	pthread_mutex_lock(&renderDataMutex);
+	while (true) {
+		while (!renderDataPending && !renderDataStop) {
+			pthread_cond_wait(&renderDataChanged, &renderDataMutex);
+		}
+		if (!renderDataPending) break;
+		size_t tick = renderTick;
+		pthread_mutex_unlock(&renderDataMutex);
+
+		double start = GetMonotonicTime();
+		BuildRenderFrame(&renderCanvas, &renderFrames[backFrame], tick);
+		PublishRenderFrame();
+		tickStats.render += RecordPhase(PHASE_RENDER_DATA, start) - start;
+
+		pthread_mutex_lock(&renderDataMutex);
+		renderDataPending = false;
+		pthread_cond_broadcast(&renderDataChanged);
+	}
+	pthread_mutex_unlock(&renderDataMutex);
+	return NULL;
+}
+
+// False if the copy can't be allocated
+static bool StartRenderPipeline() {
+	if (!InitCanvasCopy(&renderCanvas, &canvas)) return false;
+	renderDataStop = false;
+	pthread_create(&renderDataThread, NULL, RenderDataThread, NULL);
+	return true;
+}
+
+// Builds the frame still pending, if any
+static void StopRenderPipeline() {
+	pthread_mutex_lock(&renderDataMutex);
+	renderDataStop = true;
+	pthread_cond_broadcast(&renderDataChanged);
+	pthread_mutex_unlock(&renderDataMutex);
+	pthread_join(renderDataThread, NULL);
+	FreeCanvas(&renderCanvas);
+}
+#endif
+
+// Render thread: input goes to the op queue, the canvas comes from the
+// latest published frame
 // clang-format off
 void MainLoop() {
 	// Update
+	double phaseStart = GetMonotonicTime();
 	UpdateBrushCursor(&brushCursor);
 	HandleBrushOperation();
-	HandleOperation();
+	RecordPhase(PHASE_INPUT, phaseStart);
 
+#if defined(PLATFORM_WEB)
+	// No simulation thread, tick here as the frame time allows. At most
+	// options.maxTicks run per frame and as many more carry over.
 	accumulatedFrameTime += GetFrameTime();
-	while (accumulatedFrameTime >= updateFrameTime) {
+	size_t owed = OwedTicks(&accumulatedFrameTime, 2 * options.maxTicks);
+	size_t ticks = owed < options.maxTicks ? owed : options.maxTicks;
+	for (size_t i = 0; i < ticks; ++i) {
+		HandleOperation();
 		UpdateGameTick();
-		accumulatedFrameTime -= updateFrameTime;
 	}
+	accumulatedFrameTime -= ticks * updateFrameTime;
+	atomic_store(&deferredTicks, owed - ticks);
+#endif
+	const RenderFrame *frame = AcquireRenderFrame();
+	static size_t lastTick;
+	TraceCounter("Ticks per frame", frame->tick - lastTick);
+	lastTick = frame->tick;
 
 	// Draw
+	phaseStart = GetMonotonicTime();
 	BeginDrawing();
 		ClearBackground(BLACK);
-		DrawCanvasPrefab(canvasPrefab);
+		if (options.render == RENDER_TEXTURE) {
+			DrawCanvasTexture(frame);
+		} else {
+			DrawCanvasPrefab(&prefabMesh, frame);
+		}
 		DrawBrushCursor(brushCursor);
-		DrawDebugInfo(brushCursor);
+		DrawDebugInfo(brushCursor, frame);
+		phaseStart = RecordPhase(PHASE_DRAW, phaseStart);
 	EndDrawing();
+	RecordPhase(PHASE_PRESENT, phaseStart);
 }
 // clang-format on
 
+// The frame of a tick is built while the next one runs, except on the web
+// where there is no thread to build it on
 void UpdateGameTick() {
+	double start = GetMonotonicTime();
 	UpdateParticles(&canvas);
-	UpdateCanvasPrefab(&canvas);
+	double particlesDone = RecordPhase(PHASE_PARTICLES, start);
+	++tickStats.ticks;
+#if defined(PLATFORM_WEB)
+	BuildRenderFrame(&canvas, &renderFrames[backFrame], tickStats.ticks);
+	PublishRenderFrame();
+	double end = RecordPhase(PHASE_RENDER_DATA, particlesDone);
+	tickStats.render += end - particlesDone;
+#else
+	HandOffTick();
+	double end = RecordPhase(PHASE_HAND_OFF, particlesDone);
+	tickStats.handOff += end - particlesDone;
+#endif
+	TraceSpan("Tick", start, end);
+	tickStats.particles += particlesDone - start;
+}
+
+// Each frame is built incrementally against its own previous content, see
+// UpdateCanvasPrefab. `source` must keep its chunk versions in step with
+// the canvas, as the copies of SyncCanvasCopy do.
+void BuildRenderFrame(Canvas *source, RenderFrame *frame, size_t tick) {
+	if (options.render == RENDER_TEXTURE) {
+		UpdateCanvasPixels(source, &frame->pixels);
+		if (frame->pixels.changed) ++renderVersion;
+	} else {
+		UpdateCanvasPrefab(source, &frame->prefab);
+		if (frame->prefab.changed) ++renderVersion;
+	}
+	frame->version = renderVersion;
+	frame->tick = tick;
+	memcpy(frame->counts, source->counts, sizeof(frame->counts));
+}
+
+// Render data thread: hand the back frame over and take the middle one
+void PublishRenderFrame() {
+	backFrame = atomic_exchange(&middleFrame, backFrame | FRAME_PUBLISHED) &
+				~FRAME_PUBLISHED;
+}
+
+// Render thread: swap in the newest published frame, if any
+const RenderFrame *AcquireRenderFrame() {
+	if (atomic_load(&middleFrame) & FRAME_PUBLISHED) {
+		frontFrame = atomic_exchange(&middleFrame, frontFrame) &
+					 ~FRAME_PUBLISHED;
+	}
+	return &renderFrames[frontFrame];
 }
 
 void SwitchBrushType(BrushCursor *cursor, ParticleType type) {
 	cursor->type = type;
-	cursor->color = GetParticleByType(type).color;
-}
-
-Particle GetParticleByType(ParticleType type) {
-	switch (type) {
-		case PARTICLE_BORDER:
-			return BORDER;
-		case PARTICLE_AIR:
-			return AIR;
-		case PARTICLE_SAND:
-			return SAND;
-		case PARTICLE_WATER:
-			return WATER;
-		case PARTICLE_STONE:
-			return STONE;
-		case PARTICLE_WOOD:
-			return WOOD;
+	cursor->color = particleInfo[type].color;
+}
+
+// Brush draws are only added to brushStroke, BrushDraw writes them
+static void ApplyOperation(const Operation *op) {
+	if (opLog.file != NULL) OpLogWrite(&opLog, tickStats.ticks, op);
+	switch (op->type) {
+		case OP_BRUSH_DRAW:
+			if (!AddBrushStamp(&brushStroke, &op->brush)) {
+				BrushDraw(&brushStroke, &canvas);
+				AddBrushStamp(&brushStroke, &op->brush);
+			}
+			break;
+		case OP_CANVAS_SAVE:
+			// Replays leave the recorded session's snapshots alone
+			BrushDraw(&brushStroke, &canvas);
+			if (options.replay == NULL) SaveSnapshot();
+			break;
 		default:
-			return AIR;
+			break;
 	}
 }
 
-void SwapParticle(Particle *a, Particle *b) {
-	Particle tmp = *a;
-	*a = *b, *b = tmp;
+static void SaveSnapshot() {
+	const char *path = options.save != NULL ? options.save : SNAPSHOT_PATH;
+	if (SaveCanvasSnapshot(&canvas, path)) {
+		printf("Saved canvas to %s\n", path);
+	} else {
+		fprintf(stderr, "Can't save canvas to %s\n", path);
+	}
 }
 
+// Apply every pending operation. Runs of brush draws become one stroke, so
+// a backed up queue costs one pass over the cells it covers.
 void HandleOperation() {
-	if (!opQueue->len) return;
-
-	QueueNode *node = opQueue->front;
-	switch (node->op.type) {
-		case OP_BRUSH_DRAW:
-			BrushDraw(brushCursor, &canvas);
+	double start = GetMonotonicTime();
+	TraceCounter("OpQueue depth", OpQueueLen(opQueue));
+	const Operation *op;
+	while ((op = OpQueueFront(opQueue)) != NULL) {
+		ApplyOperation(op);
+		OpQueuePop(opQueue);
 	}
-	OpQueuePop(opQueue);
+	BrushDraw(&brushStroke, &canvas);
+	RecordPhase(PHASE_OPERATIONS, start);
 }
 
 void UpdateBrushCursor(BrushCursor *cursor) {
 	float wheel = GetMouseWheelMove();
-	if (wheel != 0.0) {
-		free(cursor->points);
-		cursor->points = NULL;
-		cursor->p_count = 0;
-		if (wheel < 0.0) {
-			cursor->size -= cursor->size > 1 ? 1 : 0;
-		} else {
-			++cursor->size;
-		}
+	if (wheel < 0.0) {
+		cursor->size -= cursor->size > 1 ? 1 : 0;
+	} else if (wheel > 0.0) {
+		cursor->size += cursor->size < MAX_BRUSH_SIZE ? 1 : 0;
 	}
+	cursor->stamp = GetBrushStamp(&cursorStamps, cursor->size);
 
 	Vector2 mousePosition = GetMousePosition();
 	int x = (int)roundf(mousePosition.x);
 	int y = (int)roundf(mousePosition.y);
-	int modx = x % PARTICLE_SIZE;
-	int mody = y % PARTICLE_SIZE;
-	x += roundf(modx / (float)PARTICLE_SIZE) ? PARTICLE_SIZE - modx : -modx;
-	y += roundf(mody / (float)PARTICLE_SIZE) ? PARTICLE_SIZE - mody : -mody;
-	x -= cursor->size / 2 * PARTICLE_SIZE;
-	y -= cursor->size / 2 * PARTICLE_SIZE;
+	int size = canvas.particleSize;
+	int modx = x % size;
+	int mody = y % size;
+	x += roundf(modx / (float)size) ? size - modx : -modx;
+	y += roundf(mody / (float)size) ? size - mody : -mody;
+	x -= cursor->size / 2 * size;
+	y -= cursor->size / 2 * size;
 	cursor->position = (IntVec2){x, y};
-
-	// Guard clause
-	if (cursor->points != NULL) return;
-
-	IntVec2 *brush_points =
-		malloc(sizeof(IntVec2) * cursor->size * cursor->size);
-	float radius = cursor->size / 2.0;
-	// Odd size & even size
-	if (cursor->size & 1) {
-		for (int i = 0; i < radius; ++i) {
-			for (int j = 0; j < radius; ++j) {
-				if (floorf(Hypotenuse(radius - i, radius - j)) > radius)
-					continue;
-				brush_points[cursor->p_count++] = (IntVec2){i, j};
-				if (i != (int)radius) {
-					brush_points[cursor->p_count++] =
-						(IntVec2){cursor->size - i - 1, j};
-				}
-				if (j != (int)radius) {
-					brush_points[cursor->p_count++] =
-						(IntVec2){i, cursor->size - j - 1};
-				}
-				if (i != (int)radius && j != (int)radius) {
-					brush_points[cursor->p_count++] =
-						(IntVec2){cursor->size - i - 1, cursor->size - j - 1};
-				}
-			}
-		}
-	} else {
-		for (int i = 0; i < radius; ++i) {
-			for (int j = 0; j < radius; ++j) {
-				if (roundf(Hypotenuse(radius - i, radius - j)) > radius)
-					continue;
-				brush_points[cursor->p_count++] = (IntVec2){i, j};
-				brush_points[cursor->p_count++] =
-					(IntVec2){cursor->size - i - 1, j};
-				brush_points[cursor->p_count++] =
-					(IntVec2){i, cursor->size - j - 1};
-				brush_points[cursor->p_count++] =
-					(IntVec2){cursor->size - i - 1, cursor->size - j - 1};
-			}
-		}
-	}
-	cursor->points = brush_points;
 }
 
 void HandleBrushOperation() {
+	// A coalesced op waits for the next push otherwise, which may not come
+	// before the drag is over
+	OpQueueFlush(opQueue);
+
 	switch (GetKeyPressed()) {
 		case KEY_ONE:
 			SwitchBrushType(&brushCursor, PARTICLE_AIR);
@@ -211,250 +690,327 @@ void HandleBrushOperation() {
 		case KEY_FIVE:
 			SwitchBrushType(&brushCursor, PARTICLE_WOOD);
 			break;
+		case KEY_F5:
+			OpQueuePush(opQueue, (Operation){.type = OP_CANVAS_SAVE});
+			break;
 		default:
 			break;
 	}
 
+	// While dragging each op sweeps the brush from the last position that
+	// reached the queue, so a dropped op leaves no gap in the stroke
+	static bool dragging = false;
+	static IntVec2 previous;
 	if (IsMouseButtonDown(MOUSE_BUTTON_LEFT)) {
-		OpQueuePush(opQueue, (Operation){.type = OP_BRUSH_DRAW, .data = NULL});
-	}
-}
-
-void UpdateSand(Canvas *canvas, size_t r, size_t c) {
-	if (r + 1 >= canvas->height) return;
-	if (canvas->particles[r + 1][c].type == PARTICLE_AIR) {
-		// Down
-		SwapParticle(&canvas->particles[r][c], &canvas->particles[r + 1][c]);
-		canvas->particles[r + 1][c].updated = true;
-	} else if (canvas->particles[r + 1][c].type == PARTICLE_WATER) {
-		SwapParticle(&canvas->particles[r][c], &canvas->particles[r + 1][c]);
-		canvas->particles[r + 1][c].updated = true;
-		UpdateWater(canvas, r, c);
-	} else if (c > 0 && canvas->particles[r + 1][c - 1].type == PARTICLE_AIR) {
-		// Left down
-		SwapParticle(&canvas->particles[r][c],
-					 &canvas->particles[r + 1][c - 1]);
-		canvas->particles[r + 1][c - 1].updated = true;
-	} else if (c > 0 &&
-			   canvas->particles[r + 1][c - 1].type == PARTICLE_WATER) {
-		SwapParticle(&canvas->particles[r][c],
-					 &canvas->particles[r + 1][c - 1]);
-		canvas->particles[r + 1][c - 1].updated = true;
-		UpdateWater(canvas, r, c);
-	} else if (c + 1 < canvas->width &&
-			   canvas->particles[r + 1][c + 1].type == PARTICLE_AIR) {
-		// Right down
-		SwapParticle(&canvas->particles[r][c],
-					 &canvas->particles[r + 1][c + 1]);
-		canvas->particles[r + 1][c + 1].updated = true;
-	} else if (c + 1 < canvas->width &&
-			   canvas->particles[r + 1][c + 1].type == PARTICLE_WATER) {
-		SwapParticle(&canvas->particles[r][c],
-					 &canvas->particles[r + 1][c + 1]);
-		canvas->particles[r + 1][c + 1].updated = true;
-		UpdateWater(canvas, r, c);
-	}
-}
-
-void UpdateWater(Canvas *canvas, size_t r, size_t c) {
-	// Down
-	if (r + 1 < canvas->height &&
-		canvas->particles[r + 1][c].type == PARTICLE_AIR) {
-		SwapParticle(&canvas->particles[r][c], &canvas->particles[r + 1][c]);
-		canvas->particles[r + 1][c].updated = true;
-		return;
+		IntVec2 from = dragging ? previous : brushCursor.position;
+		BrushOp brush = {
+			.x = brushCursor.position.x,
+			.y = brushCursor.position.y,
+			.fromX = from.x,
+			.fromY = from.y,
+			.size = brushCursor.size,
+			.type = brushCursor.type,
+		};
+		if (OpQueuePush(opQueue,
+						(Operation){.type = OP_BRUSH_DRAW, .brush = brush})) {
+			previous = brushCursor.position, dragging = true;
+		}
+	} else {
+		dragging = false;
 	}
+}
 
-	// Left down or Right down
-	if (r + 1 < canvas->height && c > 0 && c + 1 < canvas->width &&
-		canvas->particles[r + 1][c - 1].type == PARTICLE_AIR &&
-		canvas->particles[r + 1][c + 1].type == PARTICLE_AIR) {
-		return;
+// White where the stamp covers a cell, tinted when drawn
+static Texture2D LoadBrushTexture(const BrushStamp *stamp) {
+	Color *pixels = calloc(stamp->size * stamp->size, sizeof(Color));
+	for (size_t i = 0; i < stamp->len; ++i) {
+		BrushSpan span = stamp->spans[i];
+		for (int c = span.start; c < span.start + span.len; ++c) {
+			pixels[span.row * stamp->size + c] = WHITE;
+		}
 	}
+	Texture2D texture = LoadTextureFromImage((Image){
+		.data = pixels,
+		.width = stamp->size,
+		.height = stamp->size,
+		.mipmaps = 1,
+		.format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8,
+	});
+	free(pixels);
+	return texture;
+}
 
-	// Left down
-	if (r + 1 < canvas->height && c > 0 &&
-		canvas->particles[r + 1][c - 1].type == PARTICLE_AIR) {
-		SwapParticle(&canvas->particles[r][c],
-					 &canvas->particles[r + 1][c - 1]);
-		canvas->particles[r + 1][c - 1].updated = true;
-		return;
+// Only the current size is kept on the GPU, scrolling through sizes
+// reloads it instead of holding a texture for each
+void DrawBrushCursor(BrushCursor cursor) {
+	size_t brushSize = cursor.stamp->size;
+	if (cursorTexture.id == 0 || (size_t)cursorTexture.width != brushSize) {
+		UnloadBrushTexture();
+		cursorTexture = LoadBrushTexture(cursor.stamp);
 	}
 
-	// Right down
-	if (r + 1 < canvas->height && c + 1 < canvas->width &&
-		canvas->particles[r + 1][c + 1].type == PARTICLE_AIR) {
-		SwapParticle(&canvas->particles[r][c],
-					 &canvas->particles[r + 1][c + 1]);
-		canvas->particles[r + 1][c + 1].updated = true;
-		return;
-	}
+	float size = brushSize * canvas.particleSize;
+	DrawTexturePro(cursorTexture,
+				   (Rectangle){0, 0, brushSize, brushSize},
+				   (Rectangle){cursor.position.x, cursor.position.y, size,
+							   size},
+				   (Vector2){0, 0}, 0, cursor.color);
+}
 
-	// Left
-	if (c > 0 && canvas->particles[r][c - 1].type == PARTICLE_AIR) {
-		canvas->particles[r + 1][c + 1].updated = true;
-		SwapParticle(&canvas->particles[r][c], &canvas->particles[r][c - 1]);
-		canvas->particles[r][c - 1].updated = true;
-		return;
-	}
+void UnloadBrushTexture() {
+	if (cursorTexture.id != 0) UnloadTexture(cursorTexture);
+	cursorTexture = (Texture2D){0};
+}
 
-	// Right
-	if (c + 1 < canvas->width &&
-		canvas->particles[r][c + 1].type == PARTICLE_AIR) {
-		SwapParticle(&canvas->particles[r][c], &canvas->particles[r][c + 1]);
-		canvas->particles[r][c + 1].updated = true;
-		return;
+// False if the stroke is full or `op` has another size or type, BrushDraw
+// it then and add the op to the next one
+bool AddBrushStamp(BrushStroke *stroke, const BrushOp *op) {
+	if (stroke->len > 0 &&
+		(stroke->len == OP_QUEUE_CAPACITY || stroke->stamp->size != op->size ||
+		 stroke->type != (ParticleType)op->type)) {
+		return false;
 	}
+
+	stroke->stamp = GetBrushStamp(&stroke->stamps, op->size);
+	stroke->type = op->type;
+	stroke->segments[stroke->len++] =
+		(BrushSegment){{op->fromX, op->fromY}, {op->x, op->y}};
+	return true;
 }
 
-void UpdateParticles(Canvas *canvas) {
-	for (size_t r = canvas->height - 1; r != SIZE_MAX; --r) {
-		for (size_t c = 0; c < canvas->width; ++c) {
-			if (canvas->particles[r][c].updated) continue;
-			switch (canvas->particles[r][c].type) {
-				case PARTICLE_SAND:
-					UpdateSand(canvas, r, c);
-					break;
-				case PARTICLE_WATER:
-					UpdateWater(canvas, r, c);
-					break;
-				default:
-					break;
-			}
-		}
+// Cell of a pixel coordinate, rounding down
+static inline int PixelToCell(int pixel, int size) {
+	return pixel >= 0 ? pixel / size : -((size - 1 - pixel) / size);
+}
+
+// Union the brush swept along `segment` into the stroke mask. The stamp
+// is walked cell by cell along the line and each mask row keeps the extent
+// it covers, so a round stamp's sweep fills one span per row no matter how
+// many steps overlap there.
+// Mask rows and columns outside [0, height) x [0, width) are clipped away
+static void SweepBrushSegment(BrushStroke *stroke, BrushSegment segment,
+							  int size, int r0, int c0, size_t width,
+							  size_t height) {
+	const BrushStamp *stamp = stroke->stamp;
+	int ra = PixelToCell(segment.from.y, size) - r0;
+	int ca = PixelToCell(segment.from.x, size) - c0;
+	int rb = PixelToCell(segment.to.y, size) - r0;
+	int cb = PixelToCell(segment.to.x, size) - c0;
+
+	int top = ra < rb ? ra : rb;
+	int bottom = top + abs(rb - ra) + stamp->size;
+	if (top < 0) top = 0;
+	if (bottom > (int)height) bottom = height;
+	for (int i = top; i < bottom; ++i) {
+		stroke->rowMin[i] = INT_MAX, stroke->rowMax[i] = INT_MIN;
 	}
 
-	for (size_t r = 0; r < canvas->height; ++r) {
-		for (size_t c = 0; c < canvas->width; ++c) {
-			canvas->particles[r][c].updated = false;
+	// Bresenham from (ra, ca) to (rb, cb)
+	int dr = abs(rb - ra), dc = abs(cb - ca);
+	int sr = ra < rb ? 1 : -1, sc = ca < cb ? 1 : -1;
+	int err = dc - dr;
+	for (int r = ra, c = ca;;) {
+		for (size_t j = 0; j < stamp->len; ++j) {
+			BrushSpan span = stamp->spans[j];
+			int row = r + span.row;
+			if (row < top || row >= bottom) continue;
+			int start = c + span.start, end = start + span.len - 1;
+			if (start < 0) start = 0;
+			if (end > (int)width - 1) end = width - 1;
+			if (start < stroke->rowMin[row]) stroke->rowMin[row] = start;
+			if (end > stroke->rowMax[row]) stroke->rowMax[row] = end;
 		}
+		if (r == rb && c == cb) break;
+		int e2 = 2 * err;
+		if (e2 > -dr) err -= dr, c += sc;
+		if (e2 < dc) err += dc, r += sr;
+	}
+
+	for (int i = top; i < bottom; ++i) {
+		if (stroke->rowMin[i] > stroke->rowMax[i]) continue;
+		memset(stroke->mask + i * width + stroke->rowMin[i], 1,
+			   stroke->rowMax[i] - stroke->rowMin[i] + 1);
 	}
 }
 
-void UpdateCanvasPrefab(Canvas *canvas) {
-	size_t i, j, r, c, width, height, idx = 0;
-	bool flagw, flagh;
-	ParticleType type;
-
-	canvasPrefab.len = 0;
-	if (canvasPrefab.recs == NULL) {
-		canvasPrefab.recs = malloc(sizeof(Rectangle));
-		canvasPrefab.colors = malloc(sizeof(Color));
-	}
-
-	bool **vis = malloc(sizeof(bool *) * canvas->height);
-	for (size_t i = 0; i < canvas->width; ++i)
-		vis[i] = calloc(canvas->width, sizeof(bool));
-
-	for (i = 0; i < canvas->height; ++i) {
-		for (j = 0; j < canvas->width; ++j) {
-			if (vis[i][j] || canvas->particles[i][j].flag & PARTICLE_INVISIBLE)
-				continue;
-
-			vis[i][j] = true;
-			type = canvas->particles[i][j].type;
-			width = 1, height = 1, flagw = false, flagh = false;
-
-			while (true) {
-				if (i + height >= canvas->height) flagh = true;
-				if (j + width >= canvas->width) flagw = true;
-				if (flagh && flagw) break;
-
-				if (!flagw) {
-					for (r = i, c = j + width; r < i + height; ++r) {
-						if (vis[r][c] || canvas->particles[r][c].type != type) {
-							flagw = true;
-							break;
-						}
-					}
-					if (!flagw) {
-						++width;
-						for (r = i; r < i + height; ++r) vis[r][c] = true;
-					};
-				}
-
-				if (!flagh) {
-					for (r = i + height, c = j; c < j + width; ++c) {
-						if (vis[r][c] || canvas->particles[r][c].type != type) {
-							flagh = true;
-							break;
-						}
-					}
-					if (!flagh) {
-						++height;
-						for (c = j; c < j + width; ++c) vis[r][c] = true;
-					};
-				}
-			}
+// Write the stroke and start a new one. Segments are unioned in a mask
+// over the stroke's bounds clipped to the canvas first, then every run of
+// covered cells is written with one FillCanvasRow and marked dirty on its
+// own, so a long diagonal stroke doesn't wake its whole bounding box.
+void BrushDraw(BrushStroke *stroke, Canvas *canvas) {
+	if (stroke->len == 0) return;
 
-			if (idx >= canvasPrefab.len) {
-				canvasPrefab.len = idx + 1;
-				canvasPrefab.recs = realloc(
-					canvasPrefab.recs, sizeof(Rectangle) * canvasPrefab.len);
-				canvasPrefab.colors = realloc(canvasPrefab.colors,
-											  sizeof(Color) * canvasPrefab.len);
-			}
+	const BrushStamp *stamp = stroke->stamp;
+	int size = canvas->particleSize;
+	int r0 = INT_MAX, c0 = INT_MAX, r1 = INT_MIN, c1 = INT_MIN;
+	for (size_t i = 0; i < stroke->len; ++i) {
+		IntVec2 ends[2] = {stroke->segments[i].from, stroke->segments[i].to};
+		for (int k = 0; k < 2; ++k) {
+			int r = PixelToCell(ends[k].y, size);
+			int c = PixelToCell(ends[k].x, size);
+			if (r < r0) r0 = r;
+			if (c < c0) c0 = c;
+			if (r + (int)stamp->size - 1 > r1) r1 = r + stamp->size - 1;
+			if (c + (int)stamp->size - 1 > c1) c1 = c + stamp->size - 1;
+		}
+	}
 
-			canvasPrefab.recs[idx] =
-				(Rectangle){j * PARTICLE_SIZE, i * PARTICLE_SIZE,
-							width * PARTICLE_SIZE, height * PARTICLE_SIZE};
-			canvasPrefab.colors[idx++] = canvas->particles[i][j].color;
+	if (r0 < 0) r0 = 0;
+	if (c0 < 0) c0 = 0;
+	if (r1 > (int)canvas->height - 1) r1 = canvas->height - 1;
+	if (c1 > (int)canvas->width - 1) c1 = canvas->width - 1;
+	if (r0 > r1 || c0 > c1) {
+		stroke->len = 0;
+		return;
+	}
 
-			if (width == canvas->width) i = height - 1;
-			if (height == canvas->height) j = width - 1;
+	size_t width = c1 - c0 + 1, height = r1 - r0 + 1;
+	if (width * height > stroke->maskCap) {
+		free(stroke->mask);
+		stroke->mask = malloc(width * height);
+		stroke->maskCap = width * height;
+	}
+	if (height > stroke->rowCap) {
+		free(stroke->rowMin);
+		free(stroke->rowMax);
+		stroke->rowMin = malloc(sizeof(int) * height);
+		stroke->rowMax = malloc(sizeof(int) * height);
+		stroke->rowCap = height;
+	}
+	memset(stroke->mask, 0, width * height);
+	for (size_t i = 0; i < stroke->len; ++i) {
+		SweepBrushSegment(stroke, stroke->segments[i], size, r0, c0, width,
+						  height);
+	}
+
+	Particle particle = GetParticleByType(stroke->type);
+	for (int r = r0; r <= r1; ++r) {
+		const uint8_t *mask = stroke->mask + (r - r0) * width;
+		for (int c = c0; c <= c1; ++c) {
+			if (!mask[c - c0]) continue;
+			int start = c;
+			while (c <= c1 && mask[c - c0]) ++c;
+			FillCanvasRow(canvas, r, start, c, particle);
+			MarkDirty(canvas, r - 1, start - 1, r + 1, c);
 		}
 	}
+	stroke->len = 0;
+}
 
-	for (size_t i = 0; i < canvas->width; ++i) free(vis[i]);
-	free(vis);
+// Positions and colors interleaved, texture coordinates fall back to the
+// attribute default and sample the white default texture
+static void SetPrefabVertexAttributes() {
+	int *locs = rlGetShaderLocsDefault();
+	rlSetVertexAttribute(locs[RL_SHADER_LOC_VERTEX_POSITION], 2, RL_FLOAT,
+						 false, sizeof(PrefabVertex),
+						 (void *)offsetof(PrefabVertex, x));
+	rlEnableVertexAttribute(locs[RL_SHADER_LOC_VERTEX_POSITION]);
+	rlSetVertexAttribute(locs[RL_SHADER_LOC_VERTEX_COLOR], 4, RL_UNSIGNED_BYTE,
+						 true, sizeof(PrefabVertex),
+						 (void *)offsetof(PrefabVertex, color));
+	rlEnableVertexAttribute(locs[RL_SHADER_LOC_VERTEX_COLOR]);
+	rlDisableVertexAttribute(locs[RL_SHADER_LOC_VERTEX_TEXCOORD01]);
 }
 
-void DrawBrushCursor(BrushCursor cursor) {
-	for (size_t i = 0; i < cursor.p_count; ++i) {
-		DrawRectangleRec(
-			(Rectangle){cursor.position.x + cursor.points[i].x * PARTICLE_SIZE,
-						cursor.position.y + cursor.points[i].y * PARTICLE_SIZE,
-						PARTICLE_SIZE, PARTICLE_SIZE},
-			cursor.color);
-	}
-}
-
-void BrushDraw(BrushCursor cursor, Canvas *canvas) {
-	for (size_t i = 0; i < cursor.p_count; ++i) {
-		size_t r = (cursor.position.y + (cursor.points[i].y * PARTICLE_SIZE)) /
-				   PARTICLE_SIZE;
-		size_t c = (cursor.position.x + (cursor.points[i].x * PARTICLE_SIZE)) /
-				   PARTICLE_SIZE;
-		if (r < canvas->height && c < canvas->width) {
-			canvas->particles[r][c] = GetParticleByType(cursor.type);
-		}
+// Rebuild the vertex buffer from `prefab`. The buffer only grows, it is
+// recreated with twice the room when the prefab outgrows it.
+void UploadPrefabMesh(PrefabMesh *mesh, const CanvasPrefab *prefab) {
+	size_t len = prefab->len * 6;
+	if (len > mesh->cap) {
+		UnloadPrefabMesh(mesh);
+		mesh->cap = 6 * 1024;
+		while (mesh->cap < len) mesh->cap *= 2;
+		mesh->vertices = malloc(sizeof(PrefabVertex) * mesh->cap);
+	}
+	mesh->len = len;
+
+	for (size_t i = 0; i < prefab->len; ++i) {
+		Rectangle rec = prefab->recs[i];
+		Color color = prefab->colors[i];
+		float x0 = rec.x, y0 = rec.y;
+		float x1 = rec.x + rec.width, y1 = rec.y + rec.height;
+		PrefabVertex *v = mesh->vertices + i * 6;
+		v[0] = (PrefabVertex){x0, y0, color};
+		v[1] = (PrefabVertex){x0, y1, color};
+		v[2] = (PrefabVertex){x1, y1, color};
+		v[3] = (PrefabVertex){x0, y0, color};
+		v[4] = (PrefabVertex){x1, y1, color};
+		v[5] = (PrefabVertex){x1, y0, color};
+	}
+
+	if (mesh->vbo == 0) {
+		// Without VAO support (GLES2) the attributes are set on every draw
+		mesh->vao = rlLoadVertexArray();
+		rlEnableVertexArray(mesh->vao);
+		mesh->vbo = rlLoadVertexBuffer(
+			mesh->vertices, sizeof(PrefabVertex) * mesh->cap, true);
+		SetPrefabVertexAttributes();
+		rlDisableVertexArray();
+	} else {
+		rlUpdateVertexBuffer(mesh->vbo, mesh->vertices,
+							 sizeof(PrefabVertex) * mesh->len, 0);
 	}
 }
 
-void InitCanvas(size_t width, size_t height) {
-	canvas.width = width, canvas.height = height;
-	canvas.particles = malloc(sizeof(Particle *) * height);
-	for (int i = 0; i < CANVAS_SIZE; ++i) {
-		canvas.particles[i] = malloc(sizeof(Particle) * width);
+void UnloadPrefabMesh(PrefabMesh *mesh) {
+	if (mesh->vao != 0) rlUnloadVertexArray(mesh->vao);
+	if (mesh->vbo != 0) rlUnloadVertexBuffer(mesh->vbo);
+	free(mesh->vertices);
+	*mesh = (PrefabMesh){0};
+}
+
+// The whole prefab in one draw call with raylib's default shader
+void DrawCanvasPrefab(PrefabMesh *mesh, const RenderFrame *frame) {
+	if (mesh->version != frame->version) {
+		UploadPrefabMesh(mesh, &frame->prefab);
+		mesh->version = frame->version;
 	}
+	if (mesh->len == 0) return;
 
-	for (size_t r = 0; r < height; ++r) {
-		for (size_t c = 0; c < width; ++c) {
-			if (r == 0 || c == 0 || r == height - 1 || c == width - 1) {
-				canvas.particles[r][c] = BORDER;
-			} else {
-				canvas.particles[r][c] = AIR;
-			}
-		}
+	// Whatever raylib batched so far goes below the canvas
+	rlDrawRenderBatchActive();
+
+	int *locs = rlGetShaderLocsDefault();
+	Matrix mvp = MatrixMultiply(rlGetMatrixModelview(),
+								rlGetMatrixProjection());
+	float white[4] = {1, 1, 1, 1};
+	int texture = 0;
+	rlEnableShader(rlGetShaderIdDefault());
+	rlSetUniformMatrix(locs[RL_SHADER_LOC_MATRIX_MVP], mvp);
+	rlSetUniform(locs[RL_SHADER_LOC_COLOR_DIFFUSE], white,
+				 RL_SHADER_UNIFORM_VEC4, 1);
+	rlSetUniform(locs[RL_SHADER_LOC_MAP_DIFFUSE], &texture,
+				 RL_SHADER_UNIFORM_INT, 1);
+	rlActiveTextureSlot(0);
+	rlEnableTexture(rlGetTextureIdDefault());
+
+	if (!rlEnableVertexArray(mesh->vao)) {
+		rlEnableVertexBuffer(mesh->vbo);
+		SetPrefabVertexAttributes();
 	}
+	rlDrawVertexArray(0, mesh->len);
+
+	rlDisableVertexArray();
+	rlDisableVertexBuffer();
+	rlDisableTexture();
+	rlDisableShader();
 }
 
-void DrawCanvasPrefab(CanvasPrefab canvasPrefab) {
-	for (size_t i = 0; i < canvasPrefab.len; ++i)
-		DrawRectangleRec(canvasPrefab.recs[i], canvasPrefab.colors[i]);
+// The whole canvas as a single scaled quad
+void DrawCanvasTexture(const RenderFrame *frame) {
+	if (textureVersion != frame->version) {
+		UpdateTexture(canvasTexture, frame->pixels.pixels);
+		textureVersion = frame->version;
+	}
+	DrawTexturePro(canvasTexture,
+				   (Rectangle){0, 0, canvas.width, canvas.height},
+				   (Rectangle){0, 0, canvas.width * canvas.particleSize,
+							   canvas.height * canvas.particleSize},
+				   (Vector2){0, 0}, 0, WHITE);
 }
 
-void DrawDebugInfo(BrushCursor cursor) {
+void DrawDebugInfo(BrushCursor cursor, const RenderFrame *frame) {
+	const CanvasPrefab *canvasPrefab = &frame->prefab;
 	if (debugInfo.showBrushSize) {
 		char brushSizeText[64];
 		sprintf(brushSizeText, "Brush size: %lu", cursor.size);
@@ -510,17 +1066,61 @@ void DrawDebugInfo(BrushCursor cursor) {
 
 	if (debugInfo.showOpQueueInfo) {
 		char OpQueueInfoText[64];
-		sprintf(OpQueueInfoText, "OpQueue len: %lu", opQueue->len);
+		sprintf(OpQueueInfoText, "OpQueue len: %zu, dropped: %zu",
+				OpQueueLen(opQueue), opQueue->dropped);
 		DrawText(OpQueueInfoText, 50, 100, 10, RAYWHITE);
 	}
 
 	if (debugInfo.showCanvasPrefabInfo) {
 		char canvasPrefabInfoText[64];
 		sprintf(canvasPrefabInfoText, "Canvas prefab recs count: %lu",
-				canvasPrefab.len);
+				canvasPrefab->len);
 		DrawText(canvasPrefabInfoText, 50, 110, 10, RAYWHITE);
-		for (size_t i = 0; i < canvasPrefab.len; ++i) {
-			DrawRectangleLinesEx(canvasPrefab.recs[i], 0.5, RED);
+		for (size_t i = 0; i < canvasPrefab->len; ++i) {
+			DrawRectangleLinesEx(canvasPrefab->recs[i], 0.5, RED);
+		}
+	}
+
+	if (debugInfo.showTickInfo) {
+		// Simulated against real time, over the last half second or so
+		static double since;
+		static size_t sinceTick;
+		static float speed = 1;
+		double now = GetMonotonicTime();
+		if (since == 0) since = now, sinceTick = frame->tick;
+		if (now - since >= 0.5) {
+			speed = (frame->tick - sinceTick) / (now - since) / TARGET_TICKRATE;
+			since = now, sinceTick = frame->tick;
+		}
+		char tickInfoText[128];
+		sprintf(tickInfoText,
+				"Ticks: speed %.0f%%, deferred %zu, dropped %zu, max %zu",
+				speed * 100, atomic_load(&deferredTicks),
+				atomic_load(&droppedTicks), options.maxTicks);
+		DrawText(tickInfoText, 50, 120, 10, RAYWHITE);
+	}
+
+	if (debugInfo.showParticleCounts) {
+		char particleCountText[128];
+		sprintf(particleCountText,
+				"Particles: sand %zu, water %zu, stone %zu, wood %zu",
+				frame->counts[PARTICLE_SAND], frame->counts[PARTICLE_WATER],
+				frame->counts[PARTICLE_STONE], frame->counts[PARTICLE_WOOD]);
+		DrawText(particleCountText, 50, 130, 10, RAYWHITE);
+	}
+
+	if (debugInfo.showPhaseTimes) {
+		int y = 140;
+		for (int i = 0; i < PHASE_COUNT; ++i) {
+			PhaseStats stats = GetPhaseStats(i);
+			if (stats.len == 0) continue;
+			char phaseTimeText[128];
+			sprintf(phaseTimeText,
+					"%s: min %.2f, median %.2f, p99 %.2f, max %.2f ms",
+					GetPhaseName(i), stats.min * 1e3, stats.median * 1e3,
+					stats.p99 * 1e3, stats.max * 1e3);
+			DrawText(phaseTimeText, 50, y, 10, RAYWHITE);
+			y += 10;
 		}
 	}
 }
@@ -0,0 +1,187 @@
+#define _POSIX_C_SOURCE 200112L
+#include "snapshot.h"
+
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define MAX_RUN 256
+
+// Cells [r0, r1) x [c0, c1) of a stored chunk
+typedef struct {
+	size_t r0, c0, r1, c1;
+} ChunkBounds;
+
+static ChunkBounds GetChunkBounds(const SnapshotHeader *header, size_t i) {
+	size_t cy = i / header->chunkCols, cx = i % header->chunkCols;
+	size_t r0 = cy * header->chunkSize, c0 = cx * header->chunkSize;
+	size_t r1 = r0 + header->chunkSize, c1 = c0 + header->chunkSize;
+	return (ChunkBounds){r0, c0, r1 < header->height ? r1 : header->height,
+						 c1 < header->width ? c1 : header->width};
+}
+
+// Runs of one chunk into `out`, at most 2 bytes per cell. Returns the length.
+static size_t EncodeChunk(const Canvas *canvas, ChunkBounds b, uint8_t *out) {
+	size_t len = 0, run = 0;
+	ParticleType type = PARTICLE_BORDER;
+	for (size_t r = b.r0; r < b.r1; ++r) {
+		const Particle *row = CanvasCell(canvas, r, 0);
+		for (size_t c = b.c0; c < b.c1; ++c) {
+			ParticleType cell = GetParticleType(row[c]);
+			if (run > 0 && (cell != type || run == MAX_RUN)) {
+				out[len++] = type, out[len++] = run - 1;
+				run = 0;
+			}
+			type = cell, ++run;
+		}
+	}
+	if (run > 0) out[len++] = type, out[len++] = run - 1;
+	return len;
+}
+
+bool SaveCanvasSnapshot(const Canvas *canvas, const char *path) {
+	FILE *file = fopen(path, "wb");
+	if (file == NULL) return false;
+
+	SnapshotHeader header = {
+		.magic = SNAPSHOT_MAGIC,
+		.version = SNAPSHOT_VERSION,
+		.width = canvas->width,
+		.height = canvas->height,
+		.chunkSize = CHUNK_SIZE,
+		.chunkCols = canvas->chunkCols,
+		.chunkRows = canvas->chunkRows,
+	};
+	size_t chunkCount = canvas->chunkCols * canvas->chunkRows;
+	SnapshotChunk *index = malloc(sizeof(SnapshotChunk) * chunkCount);
+	uint8_t *data = malloc(2 * CHUNK_SIZE * CHUNK_SIZE);
+
+	// Chunks are streamed after a blank index, which is filled in at the end
+	uint64_t offset = sizeof(header) + sizeof(SnapshotChunk) * chunkCount;
+	bool ok = fseek(file, offset, SEEK_SET) == 0;
+	for (size_t i = 0; ok && i < chunkCount; ++i) {
+		size_t len = EncodeChunk(canvas, GetChunkBounds(&header, i), data);
+		index[i] = (SnapshotChunk){offset, len};
+		offset += len;
+		ok = fwrite(data, 1, len, file) == len;
+	}
+	ok = ok && fseek(file, 0, SEEK_SET) == 0 &&
+		 fwrite(&header, sizeof(header), 1, file) == 1 &&
+		 fwrite(index, sizeof(SnapshotChunk), chunkCount, file) == chunkCount;
+
+	free(data);
+	free(index);
+	return fclose(file) == 0 && ok;
+}
+
+typedef struct {
+	Canvas *canvas;
+	const uint8_t *map;
+	const SnapshotHeader *header;
+	const SnapshotChunk *index;
+	atomic_bool failed;
+} SnapshotLoad;
+
+static void DecodeChunkTask(void *ctx, size_t i, size_t worker) {
+	(void)worker;
+	SnapshotLoad *load = ctx;
+	ChunkBounds b = GetChunkBounds(load->header, i);
+	const uint8_t *data = load->map + load->index[i].offset;
+	const uint8_t *end = data + load->index[i].len;
+
+	// A run may continue on the chunk's next row
+	size_t r = b.r0, c = b.c0;
+	while (data + 1 < end && r < b.r1) {
+		ParticleType type = data[0];
+		size_t run = data[1] + 1;
+		data += 2;
+		if (type >= PARTICLE_TYPE_COUNT) break;
+
+		Particle particle = GetParticleByType(type);
+		while (run > 0 && r < b.r1) {
+			size_t n = b.c1 - c < run ? b.c1 - c : run;
+			memset(CanvasCell(load->canvas, r, c), particle, n);
+			run -= n, c += n;
+			if (c == b.c1) c = b.c0, ++r;
+		}
+		if (run > 0) break;
+	}
+	if (data != end || r != b.r1) atomic_store(&load->failed, true);
+}
+
+// The header and index fit in the file and every chunk lies within it
+static bool IsValidSnapshot(const uint8_t *map, size_t size) {
+	if (size < sizeof(SnapshotHeader)) return false;
+	const SnapshotHeader *header = (const SnapshotHeader *)map;
+	if (memcmp(header->magic, SNAPSHOT_MAGIC, 4) != 0 ||
+		header->version != SNAPSHOT_VERSION || header->width < 3 ||
+		header->width > MAX_CANVAS_SIZE || header->height < 3 ||
+		header->height > MAX_CANVAS_SIZE || header->chunkSize == 0 ||
+		header->chunkCols !=
+			(header->width + header->chunkSize - 1) / header->chunkSize ||
+		header->chunkRows !=
+			(header->height + header->chunkSize - 1) / header->chunkSize) {
+		return false;
+	}
+
+	size_t chunkCount = (size_t)header->chunkCols * header->chunkRows;
+	if ((size - sizeof(SnapshotHeader)) / sizeof(SnapshotChunk) < chunkCount) {
+		return false;
+	}
+	const SnapshotChunk *index =
+		(const SnapshotChunk *)(map + sizeof(SnapshotHeader));
+	for (size_t i = 0; i < chunkCount; ++i) {
+		if (index[i].offset > size || index[i].len > size - index[i].offset) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool LoadCanvasSnapshot(Canvas *canvas, const char *path, int particleSize,
+						size_t threads) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		close(fd);
+		return false;
+	}
+	size_t size = st.st_size;
+	const uint8_t *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) return false;
+	if (!IsValidSnapshot(map, size)) {
+		munmap((void *)map, size);
+		return false;
+	}
+
+	const SnapshotHeader *header = (const SnapshotHeader *)map;
+	if (!InitCanvas(canvas, header->width, header->height, particleSize,
+					threads)) {
+		munmap((void *)map, size);
+		return false;
+	}
+	SnapshotLoad load = {
+		.canvas = canvas,
+		.map = map,
+		.header = header,
+		.index = (const SnapshotChunk *)(map + sizeof(SnapshotHeader)),
+	};
+	atomic_init(&load.failed, false);
+	ThreadPoolRun(canvas->pool, DecodeChunkTask, &load,
+				  (size_t)header->chunkCols * header->chunkRows);
+	munmap((void *)map, size);
+
+	if (atomic_load(&load.failed)) {
+		FreeCanvas(canvas);
+		return false;
+	}
+	CountParticles(canvas);
+	MarkDirty(canvas, 0, 0, canvas->height - 1, canvas->width - 1);
+	return true;
+}
@@ -0,0 +1,153 @@
+#include "thread_pool.h"
+
+#include <stdbool.h>
+
+#include "trace.h"
+#include "util.h"
+
+#if !defined(PLATFORM_WEB)
+	#include <pthread.h>
+	#include <stdatomic.h>
+	#include <unistd.h>
+#endif
+
+#if defined(PLATFORM_WEB)
+// No pthreads without extra emscripten flags, every batch runs inline
+struct ThreadPool {
+	size_t workers;
+};
+
+ThreadPool *MakeThreadPool(size_t workers) {
+	(void)workers;
+	ThreadPool *pool = calloc(1, sizeof(ThreadPool));
+	pool->workers = 1;
+	return pool;
+}
+
+void FreeThreadPool(ThreadPool *pool) { free(pool); }
+
+#else
+struct ThreadPool {
+	size_t workers;
+	pthread_t *threads;
+	pthread_mutex_t mutex;
+	pthread_cond_t start;  // a batch was posted or the pool is stopping
+	pthread_cond_t done;   // the last helper finished the batch
+
+	// Current batch
+	ThreadPoolTask task;
+	void *ctx;
+	size_t count;
+	atomic_size_t next;    // next index to claim
+	size_t busy;           // helpers still working on the batch
+	size_t generation;     // bumped for every batch
+	bool stop;
+};
+
+typedef struct {
+	ThreadPool *pool;
+	size_t worker;
+} WorkerArgs;
+
+static void RunBatch(ThreadPool *pool, size_t worker) {
+	double start = IsTracing() ? GetMonotonicTime() : 0;
+	size_t i, ran = 0;
+	while ((i = atomic_fetch_add(&pool->next, 1)) < pool->count) {
+		pool->task(pool->ctx, i, worker);
+		++ran;
+	}
+	if (ran > 0) TraceSpan("Batch", start, GetMonotonicTime());
+}
+
+static void *WorkerMain(void *arg) {
+	WorkerArgs args = *(WorkerArgs *)arg;
+	ThreadPool *pool = args.pool;
+	free(arg);
+	TraceThreadName("Worker");
+
+	size_t seen = 0;
+	pthread_mutex_lock(&pool->mutex);
+	while (true) {
+		while (!pool->stop && pool->generation == seen) {
+			pthread_cond_wait(&pool->start, &pool->mutex);
+		}
+		if (pool->stop) break;
+		seen = pool->generation;
+		pthread_mutex_unlock(&pool->mutex);
+
+		RunBatch(pool, args.worker);
+
+		pthread_mutex_lock(&pool->mutex);
+		if (--pool->busy == 0) pthread_cond_signal(&pool->done);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+	return NULL;
+}
+
+ThreadPool *MakeThreadPool(size_t workers) {
+	if (workers == 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		workers = cpus > 0 ? (size_t)cpus : 1;
+	}
+
+	ThreadPool *pool = calloc(1, sizeof(ThreadPool));
+	pool->workers = workers;
+	pool->threads = malloc(sizeof(pthread_t) * workers);
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->start, NULL);
+	pthread_cond_init(&pool->done, NULL);
+	atomic_init(&pool->next, 0);
+
+	// Worker 0 is the thread calling ThreadPoolRun
+	for (size_t i = 1; i < workers; ++i) {
+		WorkerArgs *args = malloc(sizeof(WorkerArgs));
+		*args = (WorkerArgs){pool, i};
+		pthread_create(&pool->threads[i], NULL, WorkerMain, args);
+	}
+	return pool;
+}
+
+void FreeThreadPool(ThreadPool *pool) {
+	pthread_mutex_lock(&pool->mutex);
+	pool->stop = true;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (size_t i = 1; i < pool->workers; ++i) {
+		pthread_join(pool->threads[i], NULL);
+	}
+	pthread_cond_destroy(&pool->done);
+	pthread_cond_destroy(&pool->start);
+	pthread_mutex_destroy(&pool->mutex);
+	free(pool->threads);
+	free(pool);
+}
+#endif
+
+size_t ThreadPoolWorkers(const ThreadPool *pool) { return pool->workers; }
+
+void ThreadPoolRun(ThreadPool *pool, ThreadPoolTask task, void *ctx,
+				   size_t count) {
+#if !defined(PLATFORM_WEB)
+	// Not worth waking anyone for a single task
+	if (pool->workers > 1 && count > 1) {
+		pthread_mutex_lock(&pool->mutex);
+		pool->task = task, pool->ctx = ctx, pool->count = count;
+		atomic_store(&pool->next, 0);
+		pool->busy = pool->workers - 1;
+		++pool->generation;
+		pthread_cond_broadcast(&pool->start);
+		pthread_mutex_unlock(&pool->mutex);
+
+		RunBatch(pool, 0);
+
+		pthread_mutex_lock(&pool->mutex);
+		while (pool->busy) pthread_cond_wait(&pool->done, &pool->mutex);
+		pthread_mutex_unlock(&pool->mutex);
+		return;
+	}
+#else
+	(void)pool;
+#endif
+	for (size_t i = 0; i < count; ++i) task(ctx, i, 0);
+}
@@ -0,0 +1,216 @@
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "util.h"
+
+#if !defined(PLATFORM_WEB)
+	#include <pthread.h>
+#endif
+
+#define TRACE_BUFFER_EVENTS 4096
+#define MAX_TRACE_THREADS   256
+
+typedef enum {
+	TRACE_SPAN,
+	TRACE_COUNTER,
+	TRACE_THREAD_NAME,
+} TraceEventType;
+
+typedef struct {
+	const char *name;
+	double time;           // GetMonotonicTime seconds
+	double value;          // span end or counter value
+	TraceEventType type;
+} TraceEvent;
+
+typedef struct TraceBuffer {
+	TraceEvent events[TRACE_BUFFER_EVENTS];
+	size_t len;
+	unsigned tid;          // thread the events belong to
+	struct TraceBuffer *next;
+} TraceBuffer;
+
+atomic_bool tracing;
+static FILE *traceFile;
+static double traceStart;
+static bool traceEmpty;    // nothing written after the opening bracket yet
+
+static atomic_uint threadCount;
+static _Thread_local unsigned threadId;  // 0 until the thread traces
+static _Thread_local TraceBuffer *threadBuffer;
+// Each thread's partially filled buffer, written by StopTrace
+static TraceBuffer *threadBuffers[MAX_TRACE_THREADS];
+
+// Timestamps and durations are in microseconds
+static void WriteBuffer(const TraceBuffer *buffer) {
+	for (size_t i = 0; i < buffer->len; ++i) {
+		const TraceEvent *event = &buffer->events[i];
+		double ts = (event->time - traceStart) * 1e6;
+		fputs(traceEmpty ? "\n" : ",\n", traceFile);
+		traceEmpty = false;
+		switch (event->type) {
+			case TRACE_SPAN:
+				fprintf(traceFile,
+						"{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,"
+						"\"dur\":%.3f,\"pid\":1,\"tid\":%u}",
+						event->name, ts, (event->value - event->time) * 1e6,
+						buffer->tid);
+				break;
+			case TRACE_COUNTER:
+				fprintf(traceFile,
+						"{\"name\":\"%s\",\"ph\":\"C\",\"ts\":%.3f,"
+						"\"pid\":1,\"tid\":%u,\"args\":{\"value\":%g}}",
+						event->name, ts, buffer->tid, event->value);
+				break;
+			case TRACE_THREAD_NAME:
+				fprintf(traceFile,
+						"{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+						"\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+						buffer->tid, event->name);
+				break;
+		}
+	}
+}
+
+#if defined(PLATFORM_WEB)
+// No threads, full buffers are written right away
+static TraceBuffer *SwapBuffer(TraceBuffer *full) {
+	WriteBuffer(full);
+	full->len = 0;
+	return full;
+}
+
+static void StopWriter() {}
+#else
+static pthread_t writerThread;
+static pthread_mutex_t writerMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writerWake = PTHREAD_COND_INITIALIZER;
+static TraceBuffer *queueHead, *queueTail;  // full buffers to write
+static TraceBuffer *freeBuffers;
+static bool writerStop;
+
+static void *WriterMain(void *arg) {
+	(void)arg;
+	pthread_mutex_lock(&writerMutex);
+	while (true) {
+		while (queueHead == NULL && !writerStop) {
+			pthread_cond_wait(&writerWake, &writerMutex);
+		}
+		if (queueHead == NULL) break;
+		TraceBuffer *buffer = queueHead;
+		queueHead = buffer->next;
+		if (queueHead == NULL) queueTail = NULL;
+		pthread_mutex_unlock(&writerMutex);
+
+		WriteBuffer(buffer);
+
+		pthread_mutex_lock(&writerMutex);
+		buffer->next = freeBuffers, freeBuffers = buffer;
+	}
+	pthread_mutex_unlock(&writerMutex);
+	return NULL;
+}
+
+// Queue `full` for the writer and take an empty buffer
+static TraceBuffer *SwapBuffer(TraceBuffer *full) {
+	pthread_mutex_lock(&writerMutex);
+	full->next = NULL;
+	if (queueTail != NULL) {
+		queueTail->next = full;
+	} else {
+		queueHead = full;
+	}
+	queueTail = full;
+	pthread_cond_signal(&writerWake);
+	TraceBuffer *buffer = freeBuffers;
+	if (buffer != NULL) freeBuffers = buffer->next;
+	pthread_mutex_unlock(&writerMutex);
+
+	if (buffer == NULL) buffer = malloc(sizeof(TraceBuffer));
+	buffer->len = 0;
+	buffer->tid = full->tid;
+	return buffer;
+}
+
+// Write what is queued and wait for the writer to finish
+static void StopWriter() {
+	pthread_mutex_lock(&writerMutex);
+	writerStop = true;
+	pthread_cond_signal(&writerWake);
+	pthread_mutex_unlock(&writerMutex);
+	pthread_join(writerThread, NULL);
+
+	while (freeBuffers != NULL) {
+		TraceBuffer *next = freeBuffers->next;
+		free(freeBuffers);
+		freeBuffers = next;
+	}
+}
+#endif
+
+// NULL if the thread can't trace
+static TraceEvent *AppendEvent() {
+	if (threadBuffer == NULL) {
+		if (threadId == 0) threadId = atomic_fetch_add(&threadCount, 1) + 1;
+		if (threadId >= MAX_TRACE_THREADS) return NULL;
+		threadBuffer = malloc(sizeof(TraceBuffer));
+		threadBuffer->len = 0;
+		threadBuffer->tid = threadId;
+	} else if (threadBuffer->len == TRACE_BUFFER_EVENTS) {
+		threadBuffer = SwapBuffer(threadBuffer);
+	}
+	threadBuffers[threadId] = threadBuffer;
+	return &threadBuffer->events[threadBuffer->len++];
+}
+
+bool StartTrace(const char *path) {
+	traceFile = fopen(path, "w");
+	if (traceFile == NULL) return false;
+	fputs("{\"traceEvents\":[", traceFile);
+	traceEmpty = true;
+	traceStart = GetMonotonicTime();
+#if !defined(PLATFORM_WEB)
+	pthread_create(&writerThread, NULL, WriterMain, NULL);
+#endif
+	atomic_store(&tracing, true);
+	return true;
+}
+
+void StopTrace() {
+	if (!IsTracing()) return;
+	atomic_store(&tracing, false);
+	StopWriter();
+
+	for (size_t i = 0; i < MAX_TRACE_THREADS; ++i) {
+		if (threadBuffers[i] == NULL) continue;
+		WriteBuffer(threadBuffers[i]);
+		free(threadBuffers[i]);
+		threadBuffers[i] = NULL;
+	}
+	threadBuffer = NULL;
+	fputs("\n]}\n", traceFile);
+	fclose(traceFile);
+	traceFile = NULL;
+}
+
+void TraceThreadName(const char *name) {
+	if (!IsTracing()) return;
+	TraceEvent *event = AppendEvent();
+	if (event != NULL) *event = (TraceEvent){name, 0, 0, TRACE_THREAD_NAME};
+}
+
+void TraceSpan(const char *name, double start, double end) {
+	if (!IsTracing()) return;
+	TraceEvent *event = AppendEvent();
+	if (event != NULL) *event = (TraceEvent){name, start, end, TRACE_SPAN};
+}
+
+void TraceCounter(const char *name, double value) {
+	if (!IsTracing()) return;
+	TraceEvent *event = AppendEvent();
+	if (event != NULL) {
+		*event = (TraceEvent){name, GetMonotonicTime(), value, TRACE_COUNTER};
+	}
+}
@@ -1,5 +1,20 @@
+#define _POSIX_C_SOURCE 199309L
 #include "util.h"
 
 #include <math.h>
+#include <time.h>
 
 float Hypotenuse(float a, float b) { return sqrtf(a * a + b * b); }
+
+double GetMonotonicTime() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void SleepSeconds(double seconds) {
+	if (seconds <= 0) return;
+	struct timespec ts = {(time_t)seconds,
+						  (long)((seconds - (time_t)seconds) * 1e9)};
+	nanosleep(&ts, NULL);
+}
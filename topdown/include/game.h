@@ -6,6 +6,11 @@
 #include <stdio.h>
 #include <math.h>
 
+#if defined(PLATFORM_WEB)
+	#include <emscripten/emscripten.h>
+	#include <emscripten/html5.h>
+#endif
+
 typedef signed char            		i8;
 typedef unsigned char          		u8;
 typedef signed short int       		i16;
@@ -85,4 +90,11 @@ void UpdateText(Player player, f32 fps);
 const char *GetBoolalpha(bool value); 		// Get String format bool
 f32 GetHypotenuse(f32 a, f32 b);      		// Get hypotenuse by given legs
 
+//------------------------------------------------------------------------------
+// Trace functions, Chrome trace event JSON for chrome://tracing or Perfetto
+//------------------------------------------------------------------------------
+bool StartTrace(const char *path);     		// Start writing spans to path
+void StopTrace();                     		// Write the rest and close
+void TraceSpan(const char *name, f64 start, f64 end); // GetTime seconds
+
 #endif
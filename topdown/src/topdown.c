@@ -47,6 +47,7 @@ static Camera2D camera = {
 void MainLoop() {
 	// Update
 	//----------------------------------------------------------------------
+	f64 phaseStart = GetTime();
 	f32 fps = GetFPS();
 	f32 deltaTime = GetFrameTime();
 	f32 wheel = GetMouseWheelMove();
@@ -54,6 +55,8 @@ void MainLoop() {
 	UpdateDebugInfo();
 	UpdatePlayer(&player, envItems, envItemsLength, deltaTime);
 	UpdateCamera2D(&camera, player.location, wheel);
+	f64 drawStart = GetTime();
+	TraceSpan("Update", phaseStart, drawStart);
 
 	// clang-format off
 		// Draw
@@ -75,23 +78,50 @@ void MainLoop() {
 			EndMode2D();
 
 			UpdateText(player, fps);
+			f64 presentStart = GetTime();
+			TraceSpan("Draw", drawStart, presentStart);
 
 		EndDrawing();
+		TraceSpan("Present", presentStart, GetTime());
 	// clang-format on
 }
 
+#if defined(PLATFORM_WEB)
+// The main loop never returns, so the trace is closed as the page goes away
+static const char *StopTraceOnUnload(i32 eventType, const void *reserved,
+									 void *userData) {
+	(void)eventType, (void)reserved, (void)userData;
+	StopTrace();
+	return NULL;
+}
+#endif
+
 //------------------------------------------------------------------------------
 // Program main entry point
 //------------------------------------------------------------------------------
-i32 main(void) {
+i32 main(i32 argc, char **argv) {
+	const char *tracePath = NULL;
+	for (i32 i = 1; i < argc; ++i) {
+		if (TextIsEqual(argv[i], "--trace") && i + 1 < argc) {
+			tracePath = argv[++i];
+		} else {
+			fprintf(stderr, "Usage: %s [--trace FILE]\n", argv[0]);
+			return 1;
+		}
+	}
+
 	// Initialization
 	//--------------------------------------------------------------------------
 	InitWindow(screenWidth, screenHeight, "Hmmm...");
 	SetConfigFlags(64);
 	SetExitKey(KEY_ESCAPE);
 	SetTargetFPS(60);
+	if (tracePath != NULL && !StartTrace(tracePath)) {
+		TraceLog(LOG_WARNING, "Can't write %s", tracePath);
+	}
 
 #if defined(PLATFORM_WEB)
+	emscripten_set_beforeunload_callback(NULL, StopTraceOnUnload);
 	emscripten_set_main_loop(MainLoop, 0, 1);
 #else
 	while (!WindowShouldClose()) {
@@ -99,6 +129,7 @@ i32 main(void) {
 	}
 #endif
 
+	StopTrace();
 	CloseWindow();
 	return 0;
 }
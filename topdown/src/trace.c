@@ -0,0 +1,123 @@
+#include "game.h"
+
+#if !defined(PLATFORM_WEB)
+	#include <pthread.h>
+#endif
+
+// Spans are kept in memory and a full buffer is handed to a writer thread,
+// so formatting never lands inside a traced phase. The web build has no
+// threads and writes a full buffer right away.
+
+#define TRACE_BUFFER_EVENTS 4096
+
+typedef struct TraceEvent {
+	const char *name;
+	f64 start;       // GetTime seconds
+	f64 end;
+} TraceEvent;
+
+typedef struct TraceBuffer {
+	TraceEvent events[TRACE_BUFFER_EVENTS];
+	i32 length;
+} TraceBuffer;
+
+static FILE *traceFile;
+static TraceBuffer traceBuffers[2];
+static TraceBuffer *traceBuffer = traceBuffers;  // the one being filled
+
+static void WriteTraceEvents(TraceBuffer *buffer) {
+	for (i32 i = 0; i < buffer->length; ++i) {
+		TraceEvent *e = buffer->events + i;
+		fprintf(traceFile,
+				",\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+				"\"pid\":1,\"tid\":1}",
+				e->name, e->start * 1e6, (e->end - e->start) * 1e6);
+	}
+	buffer->length = 0;
+}
+
+#if defined(PLATFORM_WEB)
+static void SwapTraceBuffer() { WriteTraceEvents(traceBuffer); }
+
+static void StartTraceWriter() {}
+
+static void StopTraceWriter() {}
+#else
+static pthread_t writerThread;
+static pthread_mutex_t writerMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writerWake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t writerDone = PTHREAD_COND_INITIALIZER;
+static TraceBuffer *fullBuffer;  // handed to the writer, NULL once written
+static bool writerStop;
+
+static void *TraceWriterMain(void *arg) {
+	(void)arg;
+	pthread_mutex_lock(&writerMutex);
+	while (true) {
+		while (fullBuffer == NULL && !writerStop) {
+			pthread_cond_wait(&writerWake, &writerMutex);
+		}
+		if (fullBuffer == NULL) break;
+		TraceBuffer *buffer = fullBuffer;
+		pthread_mutex_unlock(&writerMutex);
+
+		WriteTraceEvents(buffer);
+
+		pthread_mutex_lock(&writerMutex);
+		fullBuffer = NULL;
+		pthread_cond_signal(&writerDone);
+	}
+	pthread_mutex_unlock(&writerMutex);
+	return NULL;
+}
+
+// Hand the full buffer to the writer and fill the other one. Waits only if
+// the writer is still on the previous buffer.
+static void SwapTraceBuffer() {
+	pthread_mutex_lock(&writerMutex);
+	while (fullBuffer != NULL) pthread_cond_wait(&writerDone, &writerMutex);
+	fullBuffer = traceBuffer;
+	pthread_cond_signal(&writerWake);
+	pthread_mutex_unlock(&writerMutex);
+	traceBuffer = traceBuffer == traceBuffers ? traceBuffers + 1 : traceBuffers;
+}
+
+static void StartTraceWriter() {
+	writerStop = false;
+	pthread_create(&writerThread, NULL, TraceWriterMain, NULL);
+}
+
+// Write what was handed over and wait for the writer to finish
+static void StopTraceWriter() {
+	pthread_mutex_lock(&writerMutex);
+	writerStop = true;
+	pthread_cond_signal(&writerWake);
+	pthread_mutex_unlock(&writerMutex);
+	pthread_join(writerThread, NULL);
+}
+#endif
+
+bool StartTrace(const char *path) {
+	traceFile = fopen(path, "w");
+	if (traceFile == NULL) return false;
+	fprintf(traceFile, "{\"traceEvents\":[\n{\"name\":\"thread_name\","
+					   "\"ph\":\"M\",\"pid\":1,\"tid\":1,"
+					   "\"args\":{\"name\":\"Main\"}}");
+	StartTraceWriter();
+	return true;
+}
+
+void StopTrace() {
+	if (traceFile == NULL) return;
+	StopTraceWriter();
+	WriteTraceEvents(traceBuffer);
+	fprintf(traceFile, "\n]}\n");
+	fclose(traceFile);
+	traceFile = NULL;
+}
+
+void TraceSpan(const char *name, f64 start, f64 end) {
+	if (traceFile == NULL) return;
+	if (traceBuffer->length == TRACE_BUFFER_EVENTS) SwapTraceBuffer();
+	traceBuffer->events[traceBuffer->length++] = (TraceEvent){name, start, end};
+}